@@ -0,0 +1,94 @@
+# Runs a benchmark scenario under cachegrind and reports the number of
+# instructions and simulated cache misses per operation.
+#
+# The scenario is run twice, with OPS and 2 * OPS operations, and the
+# difference between the runs is divided by OPS. That removes the start-up and
+# set-up cost of the benchmark program from the result.
+#
+# Usage:
+#   cmake -DVALGRIND=<valgrind> -DBENCH=<circularbuffercc-bench>
+#         -DSCENARIO=<name> -DOPS=<n> -DOUT_DIR=<dir> [-DNUM=<n>]
+#         -P cachegrind.cmake
+
+foreach(var VALGRIND BENCH SCENARIO OPS OUT_DIR)
+  if(NOT DEFINED ${var})
+    message(FATAL_ERROR "${var} is not set")
+  endif()
+endforeach()
+
+set(bench_args --scenario "${SCENARIO}")
+if(DEFINED NUM)
+  list(APPEND bench_args --num ${NUM})
+endif()
+
+file(MAKE_DIRECTORY "${OUT_DIR}")
+
+foreach(run 1 2)
+  math(EXPR ops "${OPS} * ${run}")
+  set(out_file "${OUT_DIR}/cachegrind.${SCENARIO}.${run}")
+
+  execute_process(
+    COMMAND "${VALGRIND}" --tool=cachegrind --cache-sim=yes
+            "--cachegrind-out-file=${out_file}"
+            "${BENCH}" ${bench_args} --ops ${ops}
+    RESULT_VARIABLE result
+    OUTPUT_QUIET
+    ERROR_VARIABLE error)
+  if(result)
+    message(FATAL_ERROR "cachegrind failed for ${SCENARIO}: ${result}\n${error}")
+  endif()
+
+  file(STRINGS "${out_file}" events REGEX "^events:")
+  file(STRINGS "${out_file}" summary REGEX "^summary:")
+  string(REGEX REPLACE "^events: *" "" events "${events}")
+  string(REGEX REPLACE "^summary: *" "" summary "${summary}")
+  string(REGEX REPLACE " +" ";" events "${events}")
+  string(REGEX REPLACE " +" ";" summary "${summary}")
+
+  set(index 0)
+  foreach(event ${events})
+    list(GET summary ${index} value)
+    set(${event}_${run} ${value})
+    math(EXPR index "${index} + 1")
+  endforeach()
+endforeach()
+
+foreach(event Ir I1mr ILmr Dr D1mr DLmr Dw D1mw DLmw)
+  if(NOT DEFINED ${event}_1)
+    message(FATAL_ERROR "cachegrind did not report ${event}, is the cache simulation enabled?")
+  endif()
+endforeach()
+
+# Reports the per operation value of the sum of the given events with three
+# decimals.
+function(per_op name)
+  set(diff 0)
+  foreach(event ${ARGN})
+    math(EXPR diff "${diff} + ${${event}_2} - ${${event}_1}")
+  endforeach()
+  set(sign "")
+  if(diff LESS 0)
+    set(sign "-")
+    math(EXPR diff "0 - ${diff}")
+  endif()
+  math(EXPR milli "${diff} * 1000 / ${OPS}")
+  math(EXPR whole "${milli} / 1000")
+  math(EXPR frac "${milli} % 1000")
+  string(LENGTH "${frac}" len)
+  if(len EQUAL 1)
+    set(frac "00${frac}")
+  elseif(len EQUAL 2)
+    set(frac "0${frac}")
+  endif()
+  set(line "${SCENARIO} ${name}/op ${sign}${whole}.${frac}")
+  message(STATUS "${line}")
+  file(APPEND "${OUT_DIR}/cachegrind-${SCENARIO}.txt" "${line}\n")
+endfunction()
+
+file(REMOVE "${OUT_DIR}/cachegrind-${SCENARIO}.txt")
+per_op(instructions Ir)
+per_op(data_reads Dr)
+per_op(data_writes Dw)
+per_op(I1_misses I1mr)
+per_op(D1_misses D1mr D1mw)
+per_op(LL_misses ILmr DLmr DLmw)
@@ -0,0 +1,505 @@
+/*
+ * Benchmarks for the circular buffer
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "circularbuffer.hpp"
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+typedef std::chrono::steady_clock bench_clock;
+
+// Benchmark settings, can be changed from the command line.
+struct Options {
+    size_t rings = 64;          // Number of buffers in the cold start scenario
+    size_t num = 128u * 1024;   // Number of elements in each buffer
+    size_t ops = 10000000;      // Number of operations in the throughput scenarios
+    const char* scenario = "";  // Run only this scenario if set
+    bool counters = true;       // Read hardware performance counters if available
+    size_t repeat = 5;          // Number of runs per scenario, the best one is reported
+    size_t samples = 20000;     // Number of latency samples
+    size_t block = 256;         // Number of push_pop pairs timed per latency sample
+    const char* json = nullptr;      // Write the results to this JSON file if set
+    const char* baseline = nullptr;  // Compare the results with this JSON file if set
+    double tolerance = 0.2;          // Allowed relative regression against the baseline
+};
+
+// A benchmark result that can be stored in and compared with a baseline.
+struct Metric {
+    std::string name;
+    double value;
+    bool higher_is_better;
+};
+
+// A throughput scenario, runs "ops" operations on the buffer.
+struct Scenario {
+    const char* name;
+    void (*run)(circular_buffer<uint64_t>& cbuf, size_t ops);
+};
+
+// Hardware performance counters read with perf_event_open(2) around each
+// scenario. Counters that can not be opened, e.g. when there is no PMU access
+// in a virtual machine, are reported as unavailable and the benchmark falls
+// back to timing only.
+class PerfCounters {
+   public:
+    enum Counter { CYCLES, INSTRUCTIONS, L1D_MISSES, LLC_MISSES, BRANCH_MISSES, NUM_COUNTERS };
+
+    explicit PerfCounters(bool enable) {
+        for (int i = 0; i < NUM_COUNTERS; i++) {
+            fd_[i] = -1;
+            value_[i] = 0;
+            kept_[i] = 0;
+        }
+#ifdef __linux__
+        if (!enable) {
+            return;
+        }
+        const uint64_t l1d_read_miss = PERF_COUNT_HW_CACHE_L1D |
+                                       (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                                       (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        fd_[CYCLES] = open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+        fd_[INSTRUCTIONS] = open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+        fd_[L1D_MISSES] = open(PERF_TYPE_HW_CACHE, l1d_read_miss);
+        fd_[LLC_MISSES] = open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+        fd_[BRANCH_MISSES] = open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+#else
+        (void)enable;
+#endif
+    }
+
+    ~PerfCounters() {
+#ifdef __linux__
+        for (int i = 0; i < NUM_COUNTERS; i++) {
+            if (fd_[i] >= 0) {
+                close(fd_[i]);
+            }
+        }
+#endif
+    }
+
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+
+    // Checks if at least one counter could be opened.
+    bool available() const {
+        for (int i = 0; i < NUM_COUNTERS; i++) {
+            if (fd_[i] >= 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void start() {
+#ifdef __linux__
+        for (int i = 0; i < NUM_COUNTERS; i++) {
+            if (fd_[i] >= 0) {
+                ioctl(fd_[i], PERF_EVENT_IOC_RESET, 0);
+                ioctl(fd_[i], PERF_EVENT_IOC_ENABLE, 0);
+            }
+        }
+#endif
+    }
+
+    void stop() {
+#ifdef __linux__
+        for (int i = 0; i < NUM_COUNTERS; i++) {
+            if (fd_[i] < 0) {
+                continue;
+            }
+            ioctl(fd_[i], PERF_EVENT_IOC_DISABLE, 0);
+
+            // Value, time enabled and time running. The value is scaled when
+            // the counter was multiplexed with other events.
+            uint64_t data[3] = {0, 0, 0};
+            if (read(fd_[i], data, sizeof(data)) != static_cast<ssize_t>(sizeof(data))) {
+                value_[i] = 0;
+            } else if ((data[2] > 0) && (data[2] < data[1])) {
+                value_[i] = static_cast<uint64_t>(static_cast<double>(data[0]) * data[1] / data[2]);
+            } else {
+                value_[i] = data[0];
+            }
+        }
+#endif
+    }
+
+    // Keeps the values of the last run for print(), e.g. of the fastest run.
+    void keep() {
+        for (int i = 0; i < NUM_COUNTERS; i++) {
+            kept_[i] = value_[i];
+        }
+    }
+
+    // Prints the kept counter values per operation, "-" for unavailable
+    // counters.
+    void print(size_t ops) const {
+        for (int i = 0; i < NUM_COUNTERS; i++) {
+            if (fd_[i] >= 0) {
+                std::printf(" %12.3f", static_cast<double>(kept_[i]) / ops);
+            } else {
+                std::printf(" %12s", "-");
+            }
+        }
+    }
+
+    static void print_header() {
+        std::printf(" %12s %12s %12s %12s %12s", "cycles/op", "instr/op", "L1d-miss/op",
+                    "LLC-miss/op", "br-miss/op");
+    }
+
+   private:
+#ifdef __linux__
+    static int open(uint32_t type, uint64_t config) {
+        struct perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = type;
+        attr.config = config;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+        return static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+    }
+#endif
+
+    int fd_[NUM_COUNTERS];
+    uint64_t value_[NUM_COUNTERS];
+    uint64_t kept_[NUM_COUNTERS];
+};
+
+double elapsed_ms(bench_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(bench_clock::now() - start).count();
+}
+
+// Constructs a set of large buffers and does one lap of push_back on each of
+// them. With "prefault" the pages are faulted in during construction instead
+// of on the first lap.
+void cold_start(const Options& opt, bool prefault) {
+    std::vector<std::unique_ptr<circular_buffer<uint64_t>>> rings;
+    rings.reserve(opt.rings);
+
+    auto start = bench_clock::now();
+    for (size_t i = 0; i < opt.rings; i++) {
+        rings.emplace_back(new circular_buffer<uint64_t>(opt.num));
+        if (prefault) {
+            rings.back()->prefault();
+        }
+    }
+    double construct = elapsed_ms(start);
+
+    start = bench_clock::now();
+    for (auto& ring : rings) {
+        for (uint64_t i = 0; i < opt.num; i++) {
+            ring->push_back(i);
+        }
+    }
+    double first_lap = elapsed_ms(start);
+
+    std::printf("%-24s %16.3f %16.3f\n", prefault ? "cold_start/prefault" : "cold_start/lazy",
+                construct, first_lap);
+}
+
+// Alternates push_back and pop_front with the buffer kept half full. Each
+// push_back and each pop_front counts as one operation.
+void push_pop(circular_buffer<uint64_t>& cbuf, size_t ops) {
+    uint64_t val = 0;
+
+    for (size_t i = 0; i < cbuf.space() / 2; i++) {
+        cbuf.push_back(i);
+    }
+    for (size_t i = 0; i < ops / 2; i++) {
+        cbuf.push_back(i);
+        cbuf.pop_front(val);
+    }
+    cbuf.clear();
+}
+
+// Fills the buffer with push_back and drains it with pop_front, lap after lap.
+void fill_drain(circular_buffer<uint64_t>& cbuf, size_t ops) {
+    uint64_t val = 0;
+    size_t done = 0;
+
+    while (done < ops) {
+        size_t n = 0;
+        while ((done + n < ops) && cbuf.push_back(n)) {
+            ++n;
+        }
+        done += n;
+        while ((done < ops) && cbuf.pop_front(val)) {
+            ++done;
+        }
+    }
+    cbuf.clear();
+}
+
+const Scenario scenarios[] = {
+    {"push_pop", push_pop},
+    {"fill_drain", fill_drain},
+};
+
+double run_scenario(const Options& opt, const Scenario& scenario, PerfCounters& counters) {
+    double best_ms = 0;
+
+    for (size_t i = 0; i < std::max<size_t>(opt.repeat, 1); i++) {
+        circular_buffer<uint64_t> cbuf(opt.num);
+
+        counters.start();
+        auto start = bench_clock::now();
+        scenario.run(cbuf, opt.ops);
+        double ms = elapsed_ms(start);
+        counters.stop();
+
+        if ((i == 0) || (ms < best_ms)) {
+            best_ms = ms;
+            counters.keep();
+        }
+    }
+
+    double mops = opt.ops / best_ms / 1e3;
+    std::printf("%-24s %16.3f %16.2f", scenario.name, best_ms * 1e6 / opt.ops, mops);
+    if (counters.available()) {
+        counters.print(opt.ops);
+    }
+    std::printf("\n");
+
+    return mops;
+}
+
+// Measures the latency of a push_back followed by a pop_front on a half full
+// buffer. Each sample times a block of pairs and divides, as a single pair
+// takes about as long as reading the clock. Reports the 50th and 99th
+// percentile, the best run is kept.
+void push_pop_latency(const Options& opt, double& p50, double& p99) {
+    std::vector<double> samples(std::max<size_t>(opt.samples, 1));
+    const size_t block = std::max<size_t>(opt.block, 1);
+    uint64_t val = 0;
+
+    for (size_t r = 0; r < std::max<size_t>(opt.repeat, 1); r++) {
+        circular_buffer<uint64_t> cbuf(opt.num);
+        for (size_t i = 0; i < cbuf.space() / 2; i++) {
+            cbuf.push_back(i);
+        }
+
+        for (auto& sample : samples) {
+            auto start = bench_clock::now();
+            for (size_t i = 0; i < block; i++) {
+                cbuf.push_back(val);
+                cbuf.pop_front(val);
+            }
+            sample = std::chrono::duration<double, std::nano>(bench_clock::now() - start).count() /
+                     block;
+        }
+
+        std::sort(samples.begin(), samples.end());
+        double run_p50 = samples[samples.size() / 2];
+        double run_p99 = samples[samples.size() * 99 / 100];
+        if ((r == 0) || (run_p99 < p99)) {
+            p50 = run_p50;
+            p99 = run_p99;
+        }
+    }
+
+    std::printf("%-24s %16.1f %16.1f\n", "push_pop", p50, p99);
+}
+
+bool write_json(const char* path, const std::vector<Metric>& metrics) {
+    FILE* f = std::fopen(path, "w");
+    if (f == nullptr) {
+        return false;
+    }
+
+    std::fprintf(f, "{\n");
+    for (size_t i = 0; i < metrics.size(); i++) {
+        std::fprintf(f, "    \"%s\": %.3f%s\n", metrics[i].name.c_str(), metrics[i].value,
+                     (i + 1 < metrics.size()) ? "," : "");
+    }
+    std::fprintf(f, "}\n");
+
+    return std::fclose(f) == 0;
+}
+
+// Reads a flat JSON object with number values, as written by write_json().
+bool read_json(const char* path, std::vector<std::pair<std::string, double>>& values) {
+    FILE* f = std::fopen(path, "r");
+    if (f == nullptr) {
+        return false;
+    }
+
+    std::string text;
+    char chunk[4096];
+    size_t n;
+    while ((n = std::fread(chunk, 1, sizeof(chunk), f)) > 0) {
+        text.append(chunk, n);
+    }
+    std::fclose(f);
+
+    size_t pos = 0;
+    while ((pos = text.find('"', pos)) != std::string::npos) {
+        size_t end = text.find('"', pos + 1);
+        size_t colon = (end == std::string::npos) ? end : text.find(':', end);
+        if (colon == std::string::npos) {
+            return false;
+        }
+
+        char* value_end = nullptr;
+        double value = std::strtod(text.c_str() + colon + 1, &value_end);
+        if (value_end == text.c_str() + colon + 1) {
+            return false;
+        }
+        values.emplace_back(text.substr(pos + 1, end - pos - 1), value);
+        pos = static_cast<size_t>(value_end - text.c_str());
+    }
+
+    return true;
+}
+
+// Compares the results with the baseline. Returns false if any metric has
+// regressed more than the tolerance.
+bool compare_baseline(const Options& opt, const std::vector<Metric>& metrics) {
+    std::vector<std::pair<std::string, double>> baseline;
+    if (!read_json(opt.baseline, baseline)) {
+        std::printf("Failed to read baseline: %s\n", opt.baseline);
+        return false;
+    }
+
+    bool ok = true;
+    std::printf("\n%-24s %16s %16s %10s\n", "metric", "baseline", "current", "change");
+    for (const auto& base : baseline) {
+        auto it = std::find_if(metrics.begin(), metrics.end(),
+                               [&base](const Metric& m) { return m.name == base.first; });
+        if (it == metrics.end()) {
+            std::printf("%-24s %16.3f %16s %10s\n", base.first.c_str(), base.second, "-",
+                        "missing");
+            ok = false;
+            continue;
+        }
+
+        double change = (it->value - base.second) / base.second;
+        double regression = it->higher_is_better ? -change : change;
+        bool failed = regression > opt.tolerance;
+        std::printf("%-24s %16.3f %16.3f %+9.1f%%%s\n", base.first.c_str(), base.second,
+                    it->value, change * 100, failed ? "  REGRESSION" : "");
+        ok = ok && !failed;
+    }
+
+    std::printf("\nBaseline check %s (tolerance %.0f%%)\n", ok ? "passed" : "FAILED",
+                opt.tolerance * 100);
+    return ok;
+}
+
+void usage(const char* prog) {
+    std::printf(
+        "Usage: %s [--rings N] [--num N] [--ops N] [--scenario NAME] [--no-counters]\n"
+        "       [--repeat N] [--samples N] [--block N] [--json FILE] [--baseline FILE]\n"
+        "       [--tolerance X]\n",
+        prog);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    Options opt;
+
+    for (int i = 1; i < argc; i++) {
+        if ((std::strcmp(argv[i], "--rings") == 0) && (i + 1 < argc)) {
+            opt.rings = std::strtoul(argv[++i], nullptr, 0);
+        } else if ((std::strcmp(argv[i], "--num") == 0) && (i + 1 < argc)) {
+            opt.num = std::strtoul(argv[++i], nullptr, 0);
+        } else if ((std::strcmp(argv[i], "--ops") == 0) && (i + 1 < argc)) {
+            opt.ops = std::strtoul(argv[++i], nullptr, 0);
+        } else if ((std::strcmp(argv[i], "--scenario") == 0) && (i + 1 < argc)) {
+            opt.scenario = argv[++i];
+        } else if (std::strcmp(argv[i], "--no-counters") == 0) {
+            opt.counters = false;
+        } else if ((std::strcmp(argv[i], "--repeat") == 0) && (i + 1 < argc)) {
+            opt.repeat = std::strtoul(argv[++i], nullptr, 0);
+        } else if ((std::strcmp(argv[i], "--samples") == 0) && (i + 1 < argc)) {
+            opt.samples = std::strtoul(argv[++i], nullptr, 0);
+        } else if ((std::strcmp(argv[i], "--block") == 0) && (i + 1 < argc)) {
+            opt.block = std::strtoul(argv[++i], nullptr, 0);
+        } else if ((std::strcmp(argv[i], "--json") == 0) && (i + 1 < argc)) {
+            opt.json = argv[++i];
+        } else if ((std::strcmp(argv[i], "--baseline") == 0) && (i + 1 < argc)) {
+            opt.baseline = argv[++i];
+        } else if ((std::strcmp(argv[i], "--tolerance") == 0) && (i + 1 < argc)) {
+            opt.tolerance = std::strtod(argv[++i], nullptr);
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    // A single scenario is run without any other work, which is what the
+    // instruction counting harness relies on.
+    if (opt.scenario[0] != '\0') {
+        PerfCounters counters(false);
+        opt.repeat = 1;
+        for (const auto& scenario : scenarios) {
+            if (std::strcmp(scenario.name, opt.scenario) == 0) {
+                run_scenario(opt, scenario, counters);
+                return 0;
+            }
+        }
+        std::printf("Unknown scenario: %s\n", opt.scenario);
+        return 1;
+    }
+
+    PerfCounters counters(opt.counters);
+    if (opt.counters && !counters.available()) {
+        std::printf("Hardware performance counters are not available, timing only.\n\n");
+    }
+
+    std::printf("%-24s %16s %16s", "scenario", "[ns/op]", "[Mops/s]");
+    if (counters.available()) {
+        PerfCounters::print_header();
+    }
+    std::printf("\n");
+
+    std::vector<Metric> metrics;
+    for (const auto& scenario : scenarios) {
+        double mops = run_scenario(opt, scenario, counters);
+        metrics.push_back(Metric{std::string(scenario.name) + ".mops", mops, true});
+    }
+
+    double p50 = 0;
+    double p99 = 0;
+    std::printf("\n%-24s %16s %16s\n", "latency", "p50 [ns]", "p99 [ns]");
+    push_pop_latency(opt, p50, p99);
+    metrics.push_back(Metric{"push_pop.p99_ns", p99, false});
+
+    if ((opt.json != nullptr) && !write_json(opt.json, metrics)) {
+        std::printf("Failed to write %s\n", opt.json);
+        return 1;
+    }
+    if (opt.baseline != nullptr) {
+        return compare_baseline(opt, metrics) ? 0 : 2;
+    }
+    if (opt.json != nullptr) {
+        return 0;
+    }
+
+    std::printf("\n%-24s %16s %16s\n", "scenario", "construct [ms]", "first lap [ms]");
+    cold_start(opt, false);
+    cold_start(opt, true);
+
+    return 0;
+}
@@ -31,16 +31,560 @@
  *
  * @brief       A Circular buffer template class.
  *
- * The implementation uses std::unique_ptr for automatically delete the
- * allocated dynamic memory when it not used anymore. For thread safety
- * std::mutex is used. Its require C++ latest revison 2011.
+ * The buffer storage is allocated uninitialized and the elements are
+ * constructed when added and destroyed when removed. Large buffers are mapped
+ * with mmap() so that the pages are only faulted in as the write position
+ * advances. For thread safety std::mutex is used. Its require C++ latest
+ * revison 2011.
  */
 
 #ifndef CIRCULARBUFFER_H_
 #define CIRCULARBUFFER_H_
 
-#include <memory>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
 #include <mutex>
+#include <new>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <unistd.h>
+#define CIRCULARBUFFER_HAVE_MMAP 1
+#endif
+
+/**
+ * Buffers with a storage size at or above this number of bytes are mapped
+ * with mmap() instead of allocated from the heap.
+ */
+#ifndef CIRCULARBUFFER_MMAP_THRESHOLD
+#define CIRCULARBUFFER_MMAP_THRESHOLD (64u * 1024u)
+#endif
+
+/**
+ * Keeps the bookkeeping of the optional features out of the inlined
+ * push_back() and pop_front() fast paths.
+ */
+#if defined(__GNUC__)
+#define CIRCULARBUFFER_NOINLINE __attribute__((noinline))
+#elif defined(_MSC_VER)
+#define CIRCULARBUFFER_NOINLINE __declspec(noinline)
+#else
+#define CIRCULARBUFFER_NOINLINE
+#endif
+
+/**
+ * Static USDT tracepoints, enabled by defining CIRCULARBUFFER_ENABLE_USDT.
+ * The probes are in the "circularbuffer" provider and have the buffer address
+ * and the number of elements in the buffer as arguments:
+ *
+ *   push_back  An element was added.
+ *   pop_front  An element was removed.
+ *   full       push_back() was rejected because the buffer is full.
+ *   empty      pop_front() was called on an empty buffer.
+ *   wakeup     The buffer became non-empty or reached the size awaited by
+ *              pop_batch(), and woke a waiting consumer.
+ *
+ * A probe is a single nop instruction until a tracer such as bpftrace attaches
+ * to it, e.g. bpftrace -e 'usdt:./app:circularbuffer:full { @[arg0] = count(); }'
+ */
+#ifdef CIRCULARBUFFER_ENABLE_USDT
+#include <sys/sdt.h>
+#define CIRCULARBUFFER_PROBE(name, buf, occupancy) \
+    DTRACE_PROBE2(circularbuffer, name, buf, occupancy)
+#else
+#define CIRCULARBUFFER_PROBE(name, buf, occupancy) \
+    do {                                           \
+    } while (0)
+#endif
+
+/**
+ * @brief Snapshot of the state and the operation counters of a buffer.
+ */
+struct circular_buffer_stats {
+    size_t capacity = 0;    // Max number of elements in the buffer
+    size_t granted = 0;     // Number of elements granted by the memory budget
+    size_t count = 0;       // Number of added elements in the buffer
+    size_t high_water = 0;  // Highest number of elements in the buffer
+    uint64_t pushes = 0;    // Number of added elements
+    uint64_t pops = 0;      // Number of removed elements
+    uint64_t full = 0;      // Number of push_back() calls rejected on a full buffer
+    uint64_t empty = 0;     // Number of pop_front() calls when empty
+    size_t batch_size = 0;  // Drain batch size of an adaptive_consumer, 0 if none
+
+    /**
+     * Occupancy histogram, empty unless enabled with enable_histogram(). Bucket
+     * "i" counts the sampled push_back() calls that found between
+     * i * bucket_width and (i + 1) * bucket_width - 1 elements in the buffer.
+     * The last bucket counts the calls that found the buffer full.
+     */
+    std::vector<uint64_t> histogram;
+    size_t bucket_width = 0;
+
+    /**
+     * @brief Recommends a capacity from the occupancy histogram.
+     *
+     * A push_back() is dropped when it finds the buffer full, so the fraction
+     * of the sampled push_back() calls that found at least "n" elements
+     * estimates the drop probability of a buffer with capacity "n". The
+     * estimate is only valid up to the current capacity.
+     *
+     * @param[in]   drop_probability    The target drop probability.
+     * @return              The smallest capacity, rounded to a bucket
+     *                      boundary, that meets the target. Twice the current
+     *                      capacity if the buffer already drops more than the
+     *                      target, or the current capacity if there are no
+     *                      samples.
+     */
+    size_t recommend_capacity(double drop_probability) const {
+        uint64_t total = 0;
+        for (auto n : histogram) {
+            total += n;
+        }
+        if (total == 0) {
+            return capacity;
+        }
+
+        uint64_t tail = histogram.back();
+        if (static_cast<double>(tail) / total > drop_probability) {
+            return 2 * capacity;
+        }
+
+        size_t recommended = capacity;
+        for (size_t i = histogram.size() - 1; i-- > 0;) {
+            tail += histogram[i];
+            if (static_cast<double>(tail) / total > drop_probability) {
+                break;
+            }
+            recommended = std::max<size_t>(i * bucket_width, 1);
+        }
+
+        return recommended;
+    }
+};
+
+/**
+ * @brief Adaptive capacity policy, see circular_buffer::enable_autotune().
+ */
+struct circular_buffer_autotune {
+    size_t min_capacity = 1;          // Lower capacity bound
+    size_t max_capacity = 1u << 20;   // Upper capacity bound
+    size_t grow_after_full = 4;       // Full buffer hits within a window that trigger a grow
+    size_t window = 4096;             // Number of push_back() calls per window
+    double shrink_below = 0.25;       // Low occupancy as a fraction of the capacity
+    size_t shrink_after_windows = 4;  // Low occupancy windows in a row that trigger a shrink
+};
+
+/**
+ * @brief Adaptive batch size policy, see adaptive_consumer.
+ */
+struct circular_buffer_batching {
+    std::chrono::nanoseconds target{200000};  // Target p99 queue residence time
+    size_t min_batch = 1;                     // Lower batch size bound
+    size_t max_batch = 1024;                  // Upper batch size bound
+    size_t window = 64;                       // Number of batches per adjustment
+};
+
+/**
+ * @brief Memory budget shared by many buffers.
+ *
+ * Buffers attached with circular_buffer::attach_budget() keep a minimum
+ * reservation and draw chunks from the budget as they fill. The chunks are
+ * returned as they drain. The sum of the buffer capacities can therefore
+ * exceed the budget as long as they are not all full at the same time.
+ *
+ * The budget only does the accounting. Combine it with
+ * circular_buffer::set_auto_trim() to also release the physical pages of
+ * drained buffers. The budget shall outlive the attached buffers.
+ */
+class circular_buffer_budget {
+   public:
+    /**
+     * Admission policy when a buffer asks for another chunk.
+     *
+     *   reject      Grant chunks until the budget is exhausted.
+     *   fair_share  As reject, but once three quarters of the budget are
+     *               used, a buffer that holds more than its fair share of the
+     *               unreserved budget is refused further chunks. That keeps
+     *               room for the other buffers when one of them runs away.
+     */
+    enum admission { reject, fair_share };
+
+    /**
+     * @brief The memory budget constructor.
+     *
+     * @param[in]   limit_bytes     Total number of bytes of the budget.
+     * @param[in]   chunk_bytes     Number of bytes a buffer draws at a time.
+     * @param[in]   policy          Admission policy.
+     */
+    explicit circular_buffer_budget(size_t limit_bytes, size_t chunk_bytes = 64u * 1024u,
+                                    admission policy = reject)
+        : limit_(limit_bytes), chunk_(std::max<size_t>(chunk_bytes, 1)), policy_(policy) {
+        // Do nothing.
+    }
+
+    circular_buffer_budget(const circular_buffer_budget &) = delete;
+    circular_buffer_budget &operator=(const circular_buffer_budget &) = delete;
+
+    /**
+     * @brief Gets the total number of bytes of the budget.
+     */
+    size_t limit() const { return limit_; };
+
+    /**
+     * @brief Gets the number of bytes a buffer draws at a time.
+     */
+    size_t chunk_bytes() const { return chunk_; };
+
+    /**
+     * @brief Gets the number of reserved and drawn bytes.
+     */
+    size_t used() const { return used_.load(std::memory_order_relaxed); };
+
+    /**
+     * @brief Gets the number of reserved bytes.
+     */
+    size_t reserved() const { return reserved_.load(std::memory_order_relaxed); };
+
+   private:
+    template <class T>
+    friend class circular_buffer;
+
+    bool attach(size_t reserve_bytes) {
+        if (!take(reserve_bytes)) {
+            return false;
+        }
+        reserved_ += reserve_bytes;
+        ++buffers_;
+
+        return true;
+    }
+
+    void detach(size_t reserve_bytes) {
+        unreserve(reserve_bytes);
+        --buffers_;
+    }
+
+    void unreserve(size_t bytes) {
+        reserved_ -= bytes;
+        used_ -= bytes;
+    }
+
+    // Draws "bytes" for a buffer that holds "held" bytes above its
+    // reservation.
+    bool acquire(size_t bytes, size_t held) {
+        if (policy_ == fair_share) {
+            const size_t shared = limit_ - std::min(limit_, reserved_.load());
+            const size_t share = shared / std::max<size_t>(buffers_.load(), 1);
+            if ((used() + bytes > limit_ / 4 * 3) && (held + bytes > share)) {
+                return false;
+            }
+        }
+
+        return take(bytes);
+    }
+
+    void release(size_t bytes) { used_ -= bytes; }
+
+    bool take(size_t bytes) {
+        size_t used = used_.load();
+
+        do {
+            if ((bytes > limit_) || (used > limit_ - bytes)) {
+                return false;
+            }
+        } while (!used_.compare_exchange_weak(used, used + bytes));
+
+        return true;
+    }
+
+    const size_t limit_;
+    const size_t chunk_;
+    const admission policy_;
+    std::atomic<size_t> used_{0};
+    std::atomic<size_t> reserved_{0};
+    std::atomic<size_t> buffers_{0};
+};
+
+template <class T>
+class circular_buffer;
+
+/**
+ * @brief Waits on a set of buffers until any of them has data.
+ *
+ * Each added buffer owns one bit of a ready mask. The bit is set by the
+ * push_back() that makes the buffer non-empty and cleared by the pop_front()
+ * or clear() that drains it, so a consumer only needs to look at the buffers
+ * reported as ready. Up to 64 buffers can be added. The selector shall outlive
+ * the added buffers, or they shall be removed first.
+ */
+class circular_buffer_selector {
+   public:
+    enum : size_t { max_buffers = 64 };
+
+    circular_buffer_selector() = default;
+    circular_buffer_selector(const circular_buffer_selector &) = delete;
+    circular_buffer_selector &operator=(const circular_buffer_selector &) = delete;
+
+    /**
+     * @brief Adds a buffer to the selector.
+     *
+     * @param[in]   buf     The buffer to wait on.
+     * @return              The index of the buffer's bit in the ready mask,
+     *                      max_buffers if the selector is full or the buffer
+     *                      already is added to a selector.
+     */
+    template <class T>
+    size_t add(circular_buffer<T> &buf) {
+        size_t slot;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+
+            for (slot = 0; slot < max_buffers; ++slot) {
+                if ((used_ & bit(slot)) == 0) {
+                    break;
+                }
+            }
+            if (slot == max_buffers) {
+                return max_buffers;
+            }
+            used_ |= bit(slot);
+        }
+
+        if (!buf.attach_selector(*this, slot)) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            used_ &= ~bit(slot);
+            return max_buffers;
+        }
+
+        return slot;
+    }
+
+    /**
+     * @brief Removes a buffer from the selector.
+     *
+     * @param[in]   buf     The buffer to remove.
+     */
+    template <class T>
+    void remove(circular_buffer<T> &buf) {
+        buf.detach_selector(*this);
+    }
+
+    /**
+     * @brief Blocks until any of the buffers has data.
+     *
+     * @return              The ready mask, bit "i" is set if the buffer with
+     *                      index "i" is non-empty.
+     */
+    uint64_t wait() {
+        std::unique_lock<std::mutex> lock(mutex_);
+
+        cond_.wait(lock, [this]() { return ready_ != 0; });
+
+        return ready_;
+    }
+
+    /**
+     * @brief Blocks until any of the buffers has data or the timeout expires.
+     *
+     * @param[in]   timeout The maximum time to wait.
+     * @return              The ready mask, 0 if the timeout expired.
+     */
+    template <class Rep, class Period>
+    uint64_t wait_for(const std::chrono::duration<Rep, Period> &timeout) {
+        std::unique_lock<std::mutex> lock(mutex_);
+
+        cond_.wait_for(lock, timeout, [this]() { return ready_ != 0; });
+
+        return ready_;
+    }
+
+    /**
+     * @brief Gets the ready mask without blocking.
+     *
+     * @return              The ready mask.
+     */
+    uint64_t poll() {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        return ready_;
+    }
+
+   private:
+    template <class T>
+    friend class circular_buffer;
+
+    static uint64_t bit(size_t slot) { return uint64_t(1) << slot; }
+
+    // Called by the buffer with its lock held.
+    void set_ready(size_t slot, bool ready) {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        if (ready) {
+            ready_ |= bit(slot);
+            cond_.notify_all();
+        } else {
+            ready_ &= ~bit(slot);
+        }
+    }
+
+    // Called by the buffer with its lock held.
+    void release(size_t slot) {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        ready_ &= ~bit(slot);
+        used_ &= ~bit(slot);
+    }
+
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    uint64_t used_ = 0;   // Bits of the added buffers
+    uint64_t ready_ = 0;  // Bits of the non-empty buffers
+};
+
+/**
+ * @brief Registry of named live buffers for introspection.
+ *
+ * Buffers are added with circular_buffer::register_as() and removed when
+ * unregistered or destroyed. The registry is only used when a buffer is added,
+ * removed or dumped, never by push_back() or pop_front().
+ *
+ * dump() takes locks and allocates memory, so it must not be called from a
+ * signal handler. Let the SIGUSR1 handler set a flag that an admin thread
+ * polls instead.
+ */
+class circular_buffer_registry {
+   public:
+    enum format { text, json };
+
+    /**
+     * @brief Gets the process wide registry.
+     *
+     * The registry is never destroyed, so that buffers with static storage
+     * duration can still unregister from their destructors at exit.
+     */
+    static circular_buffer_registry &instance() {
+        static circular_buffer_registry *registry = new circular_buffer_registry;
+        return *registry;
+    }
+
+    /**
+     * @brief Writes the name, capacity, occupancy, high-water mark and
+     * operation counters of every registered buffer.
+     *
+     * @param[out]  os      The stream to write to.
+     * @param[in]   fmt     One line of text per buffer or a JSON array.
+     */
+    void dump(std::ostream &os, format fmt = text) {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        if (fmt == json) {
+            os << "[";
+        }
+        for (size_t i = 0; i < entries_.size(); ++i) {
+            const circular_buffer_stats s = entries_[i].stats();
+
+            if (fmt == json) {
+                os << (i == 0 ? "\n" : ",\n") << "  {\"name\": \"" << escape(entries_[i].name)
+                   << "\", \"capacity\": " << s.capacity << ", \"count\": " << s.count
+                   << ", \"high_water\": " << s.high_water << ", \"pushes\": " << s.pushes
+                   << ", \"pops\": " << s.pops << ", \"full\": " << s.full
+                   << ", \"empty\": " << s.empty;
+                if (s.batch_size != 0) {
+                    os << ", \"batch_size\": " << s.batch_size;
+                }
+                if (!s.histogram.empty()) {
+                    os << ", \"bucket_width\": " << s.bucket_width << ", \"histogram\": [";
+                    for (size_t b = 0; b < s.histogram.size(); ++b) {
+                        os << (b == 0 ? "" : ", ") << s.histogram[b];
+                    }
+                    os << "]";
+                }
+                os << "}";
+            } else {
+                os << entries_[i].name << ": capacity=" << s.capacity << " count=" << s.count
+                   << " high_water=" << s.high_water << " pushes=" << s.pushes
+                   << " pops=" << s.pops << " full=" << s.full << " empty=" << s.empty;
+                if (s.batch_size != 0) {
+                    os << " batch_size=" << s.batch_size;
+                }
+                os << "\n";
+            }
+        }
+        if (fmt == json) {
+            os << (entries_.empty() ? "]\n" : "\n]\n");
+        }
+    }
+
+    /**
+     * @brief Gets the number of registered buffers.
+     */
+    size_t size() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return entries_.size();
+    }
+
+   private:
+    template <class T>
+    friend class circular_buffer;
+
+    struct entry {
+        const void *buf;
+        std::string name;
+        std::function<circular_buffer_stats()> stats;
+    };
+
+    circular_buffer_registry() = default;
+
+    void add(const void *buf, const std::string &name,
+             const std::function<circular_buffer_stats()> &stats) {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        for (auto &e : entries_) {
+            if (e.buf == buf) {
+                e.name = name;
+                return;
+            }
+        }
+        entries_.push_back(entry{buf, name, stats});
+    }
+
+    void remove(const void *buf) {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        entries_.erase(std::remove_if(entries_.begin(), entries_.end(),
+                                      [buf](const entry &e) { return e.buf == buf; }),
+                       entries_.end());
+    }
+
+    static std::string escape(const std::string &str) {
+        std::string out;
+
+        for (char c : str) {
+            if ((c == '"') || (c == '\\')) {
+                out += '\\';
+                out += c;
+            } else if (static_cast<unsigned char>(c) < 0x20) {
+                out += ' ';
+            } else {
+                out += c;
+            }
+        }
+
+        return out;
+    }
+
+    std::mutex mutex_;
+    std::vector<entry> entries_;
+};
 
 template <class T>
 class circular_buffer {
@@ -51,26 +595,49 @@ class circular_buffer {
      * @param[in]   num     Total number of elements that the circular buffer
      *                      can hold.
      */
-    explicit circular_buffer(size_t num) : buf_(std::unique_ptr<T[]>(new T[num])), max_(num) {
-        // Do nothing.
+    explicit circular_buffer(size_t num) : max_(num), granted_(num) {
+        buf_ = allocate(max_, mapped_);
     }
 
     /**
      * @brief The circular buffer destructor.
      */
     virtual ~circular_buffer() {
-        // Do nothing.
+        unregister();
+        detach_budget();
+        if (selector_ != nullptr) {
+            detach_selector(*selector_);
+        }
+        destroy_elements();
+        deallocate(buf_, max_, mapped_, locked_);
     }
 
+    circular_buffer(const circular_buffer &) = delete;
+    circular_buffer &operator=(const circular_buffer &) = delete;
+
     /**
      * @brief Removes all elements from the circular buffer.
      */
     void clear(void) {
         std::lock_guard<std::mutex> lock(mutex_);
 
+        if (credit_batch_ != 0) {
+            credits_.fetch_add(count_ + pending_credits_, std::memory_order_release);
+            pending_credits_ = 0;
+        }
+        destroy_elements();
         write_pos_ = 0;
         read_pos_ = 0;
         count_ = 0;
+        if (budget_ != nullptr) {
+            return_chunks();
+        }
+        if (above_high_) {
+            cross_watermark(false);
+        }
+        if (selector_ != nullptr) {
+            selector_->set_ready(selector_slot_, false);
+        }
     }
 
     /**
@@ -83,17 +650,28 @@ class circular_buffer {
     bool push_back(const T &val) {
         std::lock_guard<std::mutex> lock(mutex_);
 
-        // Check if buffer is full
-        if (count_ == max_) {
-            return false;
-        }
+        return push_locked(val);
+    };
 
-        buf_[write_pos_] = val;
-        write_pos_ = (write_pos_ + 1) % max_;
-        ++count_;
+    /**
+     * @brief Adds "num" elements at the end of the buffer under a single
+     * lock, stopping at the first one that does not fit.
+     *
+     * @param[in]   vals    Pointer to the sources to be copied.
+     * @param[in]   num     Number of elements.
+     * @return              The number of added elements.
+     */
+    size_t push_batch(const T *vals, size_t num) {
+        std::lock_guard<std::mutex> lock(mutex_);
 
-        return true;
-    };
+        for (size_t i = 0; i < num; i++) {
+            if (!push_locked(vals[i])) {
+                return i;
+            }
+        }
+
+        return num;
+    }
 
     /**
      * @brief Removes the first element from the buffer. Copies the element
@@ -109,16 +687,70 @@ class circular_buffer {
 
         // Check if empty buffer
         if (count_ == 0) {
+            CIRCULARBUFFER_PROBE(empty, this, count_);
+            ++empty_;
             return false;
         }
 
-        val = buf_[read_pos_];
-        read_pos_ = (read_pos_ + 1) % max_;
+        val = std::move(buf_[read_pos_]);
+        buf_[read_pos_].~T();
+        read_pos_ = (read_pos_ + 1 == max_) ? 0 : (read_pos_ + 1);
         --count_;
+        popped(1);
 
         return true;
     };
 
+    /**
+     * @brief Removes a batch of elements from the buffer. Blocks until the
+     * buffer holds at least "min_n" elements or the deadline has passed, then
+     * moves up to "max_n" elements to the end of "out" under a single lock.
+     *
+     * @param[out]  out         The destination of the elements.
+     * @param[in]   min_n       Number of elements to wait for.
+     * @param[in]   max_n       Maximum number of elements to remove.
+     * @param[in]   deadline    Time point after which the elements in the
+     *                          buffer are removed even if less than "min_n".
+     * @return                  The number of removed elements, 0 if the
+     *                          buffer was still empty at the deadline.
+     */
+    template <class Clock, class Duration>
+    size_t pop_batch(std::vector<T> &out, size_t min_n, size_t max_n,
+                     const std::chrono::time_point<Clock, Duration> &deadline) {
+        std::unique_lock<std::mutex> lock(mutex_);
+
+        while (count_ < min_n) {
+            batch_wake_ = std::min(batch_wake_, min_n);
+            ++batch_waiters_;
+            hooks_ |= hook_batch;
+            std::cv_status status = batch_cond_.wait_until(lock, deadline);
+            if (--batch_waiters_ == 0) {
+                batch_wake_ = SIZE_MAX;
+                hooks_ &= ~hook_batch;
+            }
+            if (status == std::cv_status::timeout) {
+                break;
+            }
+        }
+
+        size_t num = std::min(count_, max_n);
+        if (num == 0) {
+            CIRCULARBUFFER_PROBE(empty, this, count_);
+            ++empty_;
+            return 0;
+        }
+        out.reserve(out.size() + num);
+        for (size_t i = 0; i < num; i++) {
+            out.push_back(std::move(buf_[read_pos_]));
+            buf_[read_pos_].~T();
+            read_pos_ = (read_pos_ + 1 == max_) ? 0 : (read_pos_ + 1);
+        }
+        count_ -= num;
+        popped(num);
+
+        return num;
+    }
+
     /**
      * @brief Peeks the "num" element from the buffer.
      *
@@ -144,39 +776,1275 @@ class circular_buffer {
         }
 
         auto peek_pos = (read_pos_ + num) % max_;
-        elem = (buf_.get() + peek_pos);
+        elem = (buf_ + peek_pos);
 
         return true;
     };
 
     /**
-     * @brief Gets the number of added elements in the buffer.
+     * @brief Finds the first element whose key is not less than "key". The
+     * elements shall be sorted by key, e.g. records with increasing
+     * timestamps. Each of the two contiguous parts of the storage is binary
+     * searched, so the cost is O(log N).
      *
-     * @return              The number of added elements.
+     * @param[in]   key     The key to search for.
+     * @param[in]   key_of  Projection from an element to its key.
+     * @return              The number of the element, see peek(), or
+     *                      count() if there is none.
      */
-    size_t count() const { return count_; };
+    template <class Key, class KeyOf>
+    size_t lower_bound(const Key &key, KeyOf key_of) {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        return partition_point([&](const T &elem) { return key_of(elem) < key; });
+    }
 
     /**
-     * @brief Gets the number of free elements in the buffer.
+     * @brief Finds the first element whose key is greater than "key". The
+     * elements shall be sorted by key.
      *
-     * @return              The number of free elements.
+     * @param[in]   key     The key to search for.
+     * @param[in]   key_of  Projection from an element to its key.
+     * @return              The number of the element, see peek(), or
+     *                      count() if there is none.
      */
-    size_t space() const { return (max_ - count_); };
+    template <class Key, class KeyOf>
+    size_t upper_bound(const Key &key, KeyOf key_of) {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        return partition_point([&](const T &elem) { return !(key < key_of(elem)); });
+    }
 
     /**
-     * @brief Checks if the buffer is empty.
+     * @brief Finds the elements whose key equals "key". The elements shall be
+     * sorted by key.
      *
-     * @return              True if the buffer is empty otherwise false.
+     * @param[in]   key     The key to search for.
+     * @param[in]   key_of  Projection from an element to its key.
+     * @return              The numbers of the first element and one past the
+     *                      last element, equal if there is none.
      */
-    bool empty() const { return (count_ == 0); };
+    template <class Key, class KeyOf>
+    std::pair<size_t, size_t> equal_range(const Key &key, KeyOf key_of) {
+        std::lock_guard<std::mutex> lock(mutex_);
 
-   private:
-    std::mutex mutex_;
-    std::unique_ptr<T[]> buf_;  // Pointer to the buffer
-    size_t write_pos_ = 0;      // Write pointer
-    size_t read_pos_ = 0;       // Read pointer
-    size_t count_ = 0;          // Number of added elements in the buffer
-    const size_t max_;          // Max Number of elements in the buffer
+        return std::make_pair(
+            partition_point([&](const T &elem) { return key_of(elem) < key; }),
+            partition_point([&](const T &elem) { return !(key < key_of(elem)); }));
+    }
+
+    /**
+     * @brief Same as lower_bound() but probes where the key is expected from
+     * linear interpolation between the bounds, alternating with bisection.
+     * For near uniformly spaced keys, e.g. periodic timestamps, the cost is
+     * O(log log N) and it is never worse than twice the binary search. The
+     * key shall be arithmetic.
+     *
+     * @param[in]   key     The key to search for.
+     * @param[in]   key_of  Projection from an element to its key.
+     * @return              The number of the element, see peek(), or
+     *                      count() if there is none.
+     */
+    template <class Key, class KeyOf>
+    size_t interpolation_search(const Key &key, KeyOf key_of) {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        size_t lo = 0;
+        size_t hi = count_;
+        bool bisect = false;
+        while (lo < hi) {
+            size_t mid = lo + (hi - lo) / 2;
+            if (!bisect) {
+                double first = static_cast<double>(key_of(buf_[(read_pos_ + lo) % max_]));
+                double last = static_cast<double>(key_of(buf_[(read_pos_ + hi - 1) % max_]));
+                double pos = (static_cast<double>(key) - first) / (last - first);
+                if (pos <= 0) {
+                    mid = lo;
+                } else if (pos < 1) {
+                    mid = lo + static_cast<size_t>(pos * (hi - 1 - lo));
+                } else {
+                    mid = hi - 1;
+                }
+            }
+            bisect = !bisect;
+
+            if (key_of(buf_[(read_pos_ + mid) % max_]) < key) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+
+        return lo;
+    }
+
+    /**
+     * @brief Gets the number of added elements in the buffer.
+     *
+     * @return              The number of added elements.
+     */
+    size_t count() const { return count_; };
+
+    /**
+     * @brief Gets the number of free elements in the buffer.
+     *
+     * The memory budget is not taken into account: with a budget attached,
+     * push_back() fails when the budget has no chunk left even if there is
+     * free space.
+     *
+     * @return              The number of free elements.
+     */
+    size_t space() const { return (max_ - count_); };
+
+    /**
+     * @brief Checks if the buffer is empty.
+     *
+     * @return              True if the buffer is empty otherwise false.
+     */
+    bool empty() const { return (count_ == 0); };
+
+    /**
+     * @brief Faults in every page of the buffer storage.
+     *
+     * The storage is committed lazily, a page is first touched when the write
+     * position reaches it. Latency sensitive users can call this once after
+     * construction to pay for the page faults up front instead of on the first
+     * lap of push_back() calls. The content of the buffer is not changed.
+     */
+    void prefault() {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        volatile unsigned char *p = reinterpret_cast<volatile unsigned char *>(buf_);
+        const size_t bytes = max_ * sizeof(T);
+
+        for (size_t off = 0; off < bytes; off += page_size()) {
+            p[off] = p[off];
+        }
+        if (bytes > 0) {
+            p[bytes - 1] = p[bytes - 1];
+        }
+    }
+
+    /**
+     * @brief Locks the buffer storage in physical memory.
+     *
+     * All pages are faulted in and kept resident until the buffer is
+     * destroyed, see mlock(2).
+     *
+     * @return              True if success, false if locking is not supported
+     *                      or the request was refused by the system.
+     */
+    bool mlock() {
+#ifdef CIRCULARBUFFER_HAVE_MMAP
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        if (locked_ || (max_ == 0)) {
+            return true;
+        }
+        if (::mlock(buf_, max_ * sizeof(T)) != 0) {
+            return false;
+        }
+        locked_ = true;
+
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    /**
+     * @brief Checks if the buffer storage is mapped with mmap().
+     *
+     * @return              True if the storage is mapped otherwise false.
+     */
+    bool mapped() const { return mapped_; };
+
+    /**
+     * @brief Changes the capacity of the buffer.
+     *
+     * The elements are moved to a new storage, which invalidates the pointers
+     * returned by peek().
+     *
+     * @param[in]   num     The new number of elements that the buffer can
+     *                      hold.
+     * @return              True if success, false if "num" is less than the
+     *                      number of added elements or the allocation failed.
+     */
+    bool resize(size_t num) {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        if (num < count_) {
+            return false;
+        }
+        if (num == max_) {
+            return true;
+        }
+
+        return reallocate(num);
+    }
+
+    /**
+     * @brief Enables adaptive capacity.
+     *
+     * The buffer doubles its capacity when push_back() finds it full
+     * "grow_after_full" times within a window, and halves it after
+     * "shrink_after_windows" windows in a row where the occupancy stayed below
+     * "shrink_below" of the capacity. The capacity stays within the policy
+     * bounds and the memory is released by moving the elements to a smaller
+     * storage. A resize invalidates the pointers returned by peek().
+     *
+     * @param[in]   policy  The capacity bounds and thresholds.
+     */
+    void enable_autotune(const circular_buffer_autotune &policy) {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        autotune_ = policy;
+        autotune_.max_capacity = std::max(autotune_.max_capacity, autotune_.min_capacity);
+        autotune_.grow_after_full = std::max<size_t>(autotune_.grow_after_full, 1);
+        autotune_.window = std::max<size_t>(autotune_.window, 1);
+        autotune_enabled_ = true;
+        hooks_ |= hook_autotune;
+        window_pushes_ = 0;
+        window_peak_ = count_;
+        window_full_ = 0;
+        low_windows_ = 0;
+    }
+
+    /**
+     * @brief Disables adaptive capacity, the current capacity is kept.
+     */
+    void disable_autotune() {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        autotune_enabled_ = false;
+        hooks_ &= ~hook_autotune;
+    }
+
+    /**
+     * @brief Releases the physical pages of the unused part of the storage.
+     *
+     * Only whole pages that hold no added elements are released, with
+     * madvise(MADV_DONTNEED) or, if "lazy" is set and supported,
+     * madvise(MADV_FREE) which lets the kernel reclaim the pages only under
+     * memory pressure. The capacity is kept and the pages are faulted in again
+     * when written. An empty buffer restarts at the beginning of the storage.
+     *
+     * @param[in]   lazy    Use MADV_FREE instead of MADV_DONTNEED.
+     * @return              Number of released bytes, 0 if the storage is not
+     *                      mapped with mmap() or is locked with mlock().
+     */
+    size_t trim(bool lazy = false) {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        return trim_unused(lazy);
+    }
+
+    /**
+     * @brief Enables automatic trim of a drained buffer.
+     *
+     * When pop_front() removes the last element and more than "min_bytes" of
+     * the storage has been written since the last trim, the storage is
+     * trimmed with MADV_DONTNEED. While enabled, a drained buffer restarts at
+     * the beginning of the storage, so a buffer with low occupancy stays on
+     * its first pages instead of touching the whole storage over time.
+     *
+     * @param[in]   min_bytes   Written bytes that trigger a trim, 0 disables.
+     */
+    void set_auto_trim(size_t min_bytes) {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        auto_trim_bytes_ = min_bytes;
+        touched_ = max_;
+        if (min_bytes != 0) {
+            hooks_ |= hook_auto_trim;
+        } else {
+            hooks_ &= ~hook_auto_trim;
+        }
+    }
+
+    /**
+     * @brief Sets the high and low watermarks for backpressure signalling.
+     *
+     * When push_back() brings the number of elements up to "high", the
+     * buffer is above the high watermark until pop_front() or clear() brings
+     * it down to "low". The callback is called once for each of these
+     * crossings, with true when crossing the high watermark and false when
+     * crossing back below the low one. It is called with the buffer lock held
+     * and shall not call the buffer, but it can e.g. write to an eventfd.
+     * Without a callback, poll above_high_watermark() instead.
+     *
+     * @param[in]   high        The high watermark, greater than "low".
+     * @param[in]   low         The low watermark.
+     * @param[in]   callback    Called on each crossing, can be empty.
+     */
+    void set_watermarks(size_t high, size_t low,
+                        const std::function<void(bool above)> &callback = nullptr) {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        high_mark_ = std::max<size_t>(high, 1);
+        low_mark_ = std::min(low, high_mark_ - 1);
+        on_watermark_ = callback;
+        above_high_ = false;
+        hooks_ |= hook_watermarks;
+        if (count_ >= high_mark_) {
+            cross_watermark(true);
+        }
+    }
+
+    /**
+     * @brief Removes the watermarks.
+     */
+    void clear_watermarks() {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        high_mark_ = SIZE_MAX;
+        low_mark_ = 0;
+        on_watermark_ = nullptr;
+        above_high_ = false;
+        hooks_ &= ~hook_watermarks;
+    }
+
+    /**
+     * @brief Checks if the buffer has crossed the high watermark and not yet
+     * come back down to the low watermark. Can be polled without taking the
+     * buffer lock.
+     *
+     * @return              True if above the high watermark otherwise false.
+     */
+    bool above_high_watermark() const { return above_high_.load(std::memory_order_relaxed); };
+
+    /**
+     * @brief Enables credit based flow control.
+     *
+     * The free space, see space(), is handed out as credits that producers
+     * take with acquire_credits(), typically through a credit_producer that
+     * stages its elements and adds them with push_batch() under a single
+     * lock. Every producer shall hold a credit for each element it adds while
+     * enabled. pop_front() hands the freed slots back in batches of "batch"
+     * credits, or all of them when the buffer drains, and clear() hands them
+     * all back at once. A larger capacity adds credits, a smaller one does not
+     * take any back, so after a shrink, or when a memory budget refuses it, an
+     * element added with a credit can still be rejected.
+     *
+     * @param[in]   batch   Number of freed slots returned at a time.
+     */
+    void enable_credits(size_t batch) {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        credit_batch_ = std::max<size_t>(batch, 1);
+        hooks_ |= hook_credits;
+        pending_credits_ = 0;
+        credits_.store(max_ - count_);
+    }
+
+    /**
+     * @brief Takes up to "num" credits, without taking the buffer lock.
+     *
+     * @param[in]   num     The wanted number of credits.
+     * @return              The number of taken credits, 0 if there are none.
+     */
+    size_t acquire_credits(size_t num) {
+        size_t avail = credits_.load(std::memory_order_relaxed);
+        size_t take;
+
+        do {
+            take = std::min(avail, num);
+            if (take == 0) {
+                return 0;
+            }
+        } while (!credits_.compare_exchange_weak(avail, avail - take, std::memory_order_acquire,
+                                                 std::memory_order_relaxed));
+
+        return take;
+    }
+
+    /**
+     * @brief Gives back unused credits.
+     *
+     * @param[in]   num     The number of credits to give back.
+     */
+    void release_credits(size_t num) { credits_.fetch_add(num, std::memory_order_release); }
+
+    /**
+     * @brief Hands the freed slots that are not yet returned back as credits.
+     */
+    void flush_credits() {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        credits_.fetch_add(pending_credits_, std::memory_order_release);
+        pending_credits_ = 0;
+    }
+
+    /**
+     * @brief Gets the selector the buffer is added to.
+     *
+     * @return              The selector, null if none.
+     */
+    circular_buffer_selector *selector() {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        return selector_;
+    }
+
+    /**
+     * @brief Attaches the buffer to a shared memory budget.
+     *
+     * The buffer keeps "reserve" elements, or at least the added ones, as its
+     * reservation. Beyond that, push_back() draws chunks from the budget and
+     * fails when the budget refuses one. pop_front() returns the chunks that
+     * are no longer needed. A buffer can only be attached to one budget.
+     *
+     * @param[in]   budget  The budget to draw from.
+     * @param[in]   reserve Number of elements that are always available.
+     * @return              True if success, false if the reservation does
+     *                      not fit in the budget.
+     */
+    bool attach_budget(circular_buffer_budget &budget, size_t reserve) {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        if (budget_ != nullptr) {
+            return false;
+        }
+
+        reserve = std::min(std::max(reserve, count_), max_);
+        if (!budget.attach(reserve * sizeof(T))) {
+            return false;
+        }
+        budget_ = &budget;
+        reserved_ = reserve;
+        granted_ = reserve;
+        hooks_ |= hook_budget;
+        chunk_elems_ = std::max<size_t>(budget.chunk_bytes() / sizeof(T), 1);
+
+        return true;
+    }
+
+    /**
+     * @brief Returns the reservation and the drawn chunks to the budget.
+     */
+    void detach_budget() {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        if (budget_ == nullptr) {
+            return;
+        }
+        budget_->release((granted_ - reserved_) * sizeof(T));
+        budget_->detach(reserved_ * sizeof(T));
+        budget_ = nullptr;
+        granted_ = max_;
+        hooks_ &= ~hook_budget;
+    }
+
+    /**
+     * @brief Gets a snapshot of the state and the operation counters.
+     *
+     * @return              The buffer statistics.
+     */
+    circular_buffer_stats stats() {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        circular_buffer_stats s;
+        s.capacity = max_;
+        s.granted = granted_;
+        s.count = count_;
+        s.high_water = high_water_;
+        s.pushes = pushes_;
+        s.pops = pops_;
+        s.full = full_;
+        s.empty = empty_;
+        s.histogram = histogram_;
+        s.bucket_width = bucket_width_;
+        s.batch_size = batch_size_;
+
+        return s;
+    }
+
+    /**
+     * @brief Enables the occupancy histogram.
+     *
+     * The histogram is sampled on push_back(), once every "sample_period"
+     * calls, and covers the capacity with "buckets" buckets plus one bucket
+     * for a full buffer. Enabling it again, or a change of the capacity,
+     * clears it.
+     *
+     * @param[in]   buckets         Number of buckets, at least 1.
+     * @param[in]   sample_period   Sample every n:th push_back() call, rounded
+     *                              up to a power of two.
+     */
+    void enable_histogram(size_t buckets = 32, size_t sample_period = 1) {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        setup_histogram(buckets, sample_period);
+    }
+
+    /**
+     * @brief Restarts the high-water mark and the occupancy histogram.
+     *
+     * The operation counters are not reset.
+     */
+    void reset_stats() {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        high_water_ = count_;
+        std::fill(histogram_.begin(), histogram_.end(), 0);
+        samples_ = 0;
+    }
+
+    /**
+     * @brief Adds the buffer to the circular_buffer_registry.
+     *
+     * Registering again only changes the name. The buffer is removed from the
+     * registry when destroyed.
+     *
+     * @param[in]   name    The name shown in the registry dump.
+     */
+    void register_as(const std::string &name) {
+        circular_buffer_registry::instance().add(this, name, [this]() { return stats(); });
+        registered_ = true;
+    }
+
+    /**
+     * @brief Removes the buffer from the circular_buffer_registry.
+     */
+    void unregister() {
+        if (registered_) {
+            circular_buffer_registry::instance().remove(this);
+            registered_ = false;
+        }
+    }
+
+   private:
+    // Optional features with bookkeeping in push_back() and popped(), one bit
+    // each in hooks_ so that the plain buffer pays for a single test.
+    enum : uint32_t {
+        hook_histogram = 1,
+        hook_autotune = 2,
+        hook_auto_trim = 4,
+        hook_watermarks = 8,
+        hook_credits = 16,
+        hook_selector = 32,
+        hook_batch = 64,
+        hook_budget = 128
+    };
+
+    static size_t page_size() {
+#ifdef CIRCULARBUFFER_HAVE_MMAP
+        static const size_t size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        return size;
+#else
+        return 4096u;
+#endif
+    }
+
+    static T *allocate(size_t num, bool &mapped) {
+        if (num > SIZE_MAX / sizeof(T)) {
+            throw std::bad_array_new_length();
+        }
+        const size_t bytes = num * sizeof(T);
+
+        mapped = false;
+        if (bytes == 0) {
+            return nullptr;
+        }
+#ifdef CIRCULARBUFFER_HAVE_MMAP
+        if (bytes >= CIRCULARBUFFER_MMAP_THRESHOLD) {
+            void *p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1,
+                           0);
+            if (p == MAP_FAILED) {
+                throw std::bad_alloc();
+            }
+            mapped = true;
+            return static_cast<T *>(p);
+        }
+#endif
+        return static_cast<T *>(heap_allocate(bytes));
+    }
+
+    static void deallocate(T *buf, size_t num, bool mapped, bool locked) {
+        if (buf == nullptr) {
+            return;
+        }
+#ifdef CIRCULARBUFFER_HAVE_MMAP
+        if (locked) {
+            ::munlock(buf, num * sizeof(T));
+        }
+        if (mapped) {
+            munmap(buf, num * sizeof(T));
+            return;
+        }
+#else
+        (void)num;
+        (void)mapped;
+        (void)locked;
+#endif
+        heap_deallocate(buf);
+    }
+
+    // Allocates "bytes" from the heap, aligned for T. The pointer to free is
+    // stored in front of the storage of an over-aligned T.
+    static void *heap_allocate(size_t bytes) {
+        if (alignof(T) <= alignof(std::max_align_t)) {
+            return ::operator new(bytes);
+        }
+
+        const size_t extra = alignof(T) - 1 + sizeof(void *);
+        if (bytes > SIZE_MAX - extra) {
+            throw std::bad_array_new_length();
+        }
+        void *raw = ::operator new(bytes + extra);
+        const uintptr_t mask = alignof(T) - 1;
+        void **buf = reinterpret_cast<void **>((reinterpret_cast<uintptr_t>(raw) + extra) & ~mask);
+        buf[-1] = raw;
+
+        return buf;
+    }
+
+    static void heap_deallocate(void *buf) {
+        if (alignof(T) > alignof(std::max_align_t)) {
+            buf = static_cast<void **>(buf)[-1];
+        }
+        ::operator delete(buf);
+    }
+
+    // Moves the elements to a new storage of "num" elements. The mutex shall
+    // be held and "num" shall not be less than count_.
+    bool reallocate(size_t num) {
+        bool mapped = false;
+        T *buf = nullptr;
+
+        try {
+            buf = allocate(num, mapped);
+        } catch (const std::bad_alloc &) {
+            return false;
+        }
+
+        for (size_t i = 0; i < count_; ++i) {
+            T &elem = buf_[(read_pos_ + i) % max_];
+            new (buf + i) T(std::move(elem));
+            elem.~T();
+        }
+
+        bool locked = false;
+#ifdef CIRCULARBUFFER_HAVE_MMAP
+        locked = locked_ && (num > 0) && (::mlock(buf, num * sizeof(T)) == 0);
+#endif
+        deallocate(buf_, max_, mapped_, locked_);
+
+        const size_t max_old = max_;
+        buf_ = buf;
+        max_ = num;
+        mapped_ = mapped;
+        locked_ = locked;
+        read_pos_ = 0;
+        write_pos_ = (num == 0) ? 0 : (count_ % num);
+        touched_ = count_;
+
+        if ((credit_batch_ != 0) && (num > max_old)) {
+            credits_.fetch_add(num - max_old, std::memory_order_release);
+        }
+
+        if (budget_ == nullptr) {
+            granted_ = num;
+        } else {
+            if (reserved_ > num) {
+                budget_->unreserve((reserved_ - num) * sizeof(T));
+                granted_ -= reserved_ - num;
+                reserved_ = num;
+            }
+            if (granted_ > num) {
+                budget_->release((granted_ - num) * sizeof(T));
+                granted_ = num;
+            }
+        }
+
+        if (!histogram_.empty()) {
+            setup_histogram(histogram_buckets_, sample_mask_ + 1);
+        }
+
+        return true;
+    }
+
+    // Releases the whole pages of the free part of the storage. The mutex
+    // shall be held.
+    size_t trim_unused(bool lazy) {
+        size_t released = 0;
+
+        if (count_ == 0) {
+            read_pos_ = 0;
+            write_pos_ = 0;
+        }
+
+#ifdef CIRCULARBUFFER_HAVE_MMAP
+        if (!mapped_ || locked_ || (count_ == max_)) {
+            return 0;
+        }
+
+        int advice = MADV_DONTNEED;
+#ifdef MADV_FREE
+        if (lazy) {
+            advice = MADV_FREE;
+        }
+#else
+        (void)lazy;
+#endif
+
+        // The free slots are from the write position up to the read position,
+        // which is one range or two when it wraps around.
+        if (write_pos_ < read_pos_) {
+            released += release(write_pos_, read_pos_, advice);
+        } else {
+            released += release(write_pos_, max_, advice);
+            released += release(0, read_pos_, advice);
+        }
+#else
+        (void)lazy;
+#endif
+        touched_ = 0;
+
+        return released;
+    }
+
+#ifdef CIRCULARBUFFER_HAVE_MMAP
+    // Releases the whole pages within the slots from "first" up to "last".
+    size_t release(size_t first, size_t last, int advice) {
+        const uintptr_t mask = page_size() - 1;
+        const uintptr_t begin = (reinterpret_cast<uintptr_t>(buf_ + first) + mask) & ~mask;
+        const uintptr_t end = reinterpret_cast<uintptr_t>(buf_ + last) & ~mask;
+
+        if (begin >= end) {
+            return 0;
+        }
+        if (madvise(reinterpret_cast<void *>(begin), end - begin, advice) != 0) {
+            return 0;
+        }
+
+        return end - begin;
+    }
+#endif
+
+    // Called when the buffer has been drained with automatic trim enabled.
+    // The mutex shall be held.
+    void auto_trim() {
+        if (touched_ * sizeof(T) > auto_trim_bytes_) {
+            trim_unused(false);
+        } else {
+            read_pos_ = 0;
+            write_pos_ = 0;
+        }
+    }
+
+    void setup_histogram(size_t buckets, size_t sample_period) {
+        histogram_buckets_ = buckets;
+        buckets = std::max<size_t>(std::min(buckets, max_), 1);
+        bucket_width_ = std::max<size_t>((max_ + buckets - 1) / buckets, 1);
+        histogram_.assign((max_ + bucket_width_ - 1) / bucket_width_ + 1, 0);
+
+        size_t period = 1;
+        while (period < sample_period) {
+            period <<= 1;
+        }
+        sample_mask_ = period - 1;
+        samples_ = 0;
+        hooks_ |= hook_histogram;
+    }
+
+    // Adds "val" at the end of the buffer. The mutex shall be held.
+    bool push_locked(const T &val) {
+        if (hooks_ != 0) {
+            return push_back_hooked(val);
+        }
+
+        // Check if buffer is full
+        if (count_ == max_) {
+            CIRCULARBUFFER_PROBE(full, this, count_);
+            ++full_;
+            return false;
+        }
+
+        store(val);
+        CIRCULARBUFFER_PROBE(push_back, this, count_);
+
+        return true;
+    }
+
+    // Constructs a copy of "val" at the write position. The buffer shall not
+    // be full and the mutex shall be held.
+    void store(const T &val) {
+        new (buf_ + write_pos_) T(val);
+        write_pos_ = (write_pos_ + 1 == max_) ? 0 : (write_pos_ + 1);
+        ++count_;
+        ++pushes_;
+        if (count_ > high_water_) {
+            high_water_ = count_;
+        }
+    }
+
+    // The push_back() path taken while any optional feature is enabled. The
+    // mutex shall be held.
+    CIRCULARBUFFER_NOINLINE bool push_back_hooked(const T &val) {
+        if ((hooks_ & hook_histogram) && ((++samples_ & sample_mask_) == 0)) {
+            ++histogram_[(count_ == max_) ? (histogram_.size() - 1) : (count_ / bucket_width_)];
+        }
+
+        // Check if buffer is full
+        if ((count_ == granted_) && !make_room()) {
+            CIRCULARBUFFER_PROBE(full, this, count_);
+            ++full_;
+            return false;
+        }
+
+        store(val);
+        if (hooks_ & hook_auto_trim) {
+            touched_ = std::max(touched_, (write_pos_ == 0) ? max_ : write_pos_);
+        }
+        if (hooks_ & hook_autotune) {
+            autotune_update();
+        }
+        if ((hooks_ & hook_watermarks) && (count_ >= high_mark_) && !above_high_) {
+            cross_watermark(true);
+        }
+        if ((hooks_ & hook_selector) && (count_ == 1)) {
+            CIRCULARBUFFER_PROBE(wakeup, this, count_);
+            selector_->set_ready(selector_slot_, true);
+        }
+        if ((hooks_ & hook_batch) && (count_ >= batch_wake_)) {
+            CIRCULARBUFFER_PROBE(wakeup, this, count_);
+            batch_wake_ = SIZE_MAX;
+            batch_cond_.notify_all();
+        }
+        CIRCULARBUFFER_PROBE(push_back, this, count_);
+
+        return true;
+    }
+
+    // Makes room for one more element when count_ has reached granted_, by
+    // growing the buffer or drawing a chunk from the budget. The mutex shall
+    // be held.
+    bool make_room() {
+        if (count_ == max_) {
+            if (!autotune_enabled_ || !autotune_grow()) {
+                return false;
+            }
+            if (budget_ == nullptr) {
+                return true;
+            }
+        }
+        if (budget_ == nullptr) {
+            return false;
+        }
+
+        const size_t elems = std::min(chunk_elems_, max_ - granted_);
+        if (!budget_->acquire(elems * sizeof(T), (granted_ - reserved_) * sizeof(T))) {
+            return false;
+        }
+        granted_ += elems;
+
+        return true;
+    }
+
+    // Returns the chunks beyond the one with free slots to the budget, keeping
+    // the reservation. The mutex shall be held.
+    void return_chunks() {
+        const size_t keep = std::max(reserved_, count_ + chunk_elems_);
+
+        if (granted_ > keep) {
+            budget_->release((granted_ - keep) * sizeof(T));
+            granted_ = keep;
+        }
+    }
+
+    // Records a watermark crossing and calls the callback. The mutex shall be
+    // held.
+    void cross_watermark(bool above) {
+        above_high_.store(above, std::memory_order_relaxed);
+        if (on_watermark_) {
+            on_watermark_(above);
+        }
+    }
+
+    friend class circular_buffer_selector;
+
+    bool attach_selector(circular_buffer_selector &selector, size_t slot) {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        if (selector_ != nullptr) {
+            return false;
+        }
+        selector_ = &selector;
+        selector_slot_ = slot;
+        hooks_ |= hook_selector;
+        if (count_ > 0) {
+            selector_->set_ready(selector_slot_, true);
+        }
+
+        return true;
+    }
+
+    void detach_selector(circular_buffer_selector &selector) {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        if (selector_ == &selector) {
+            selector_->release(selector_slot_);
+            selector_ = nullptr;
+            hooks_ &= ~hook_selector;
+        }
+    }
+
+    template <class U>
+    friend class adaptive_consumer;
+
+    void set_batch_size(size_t num) {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        batch_size_ = num;
+    }
+
+    // Gets the number of the first element for which "pred" is false, where
+    // "pred" is true for all elements before it. Searches the part from the
+    // read position to the end of the storage, or the wrapped part from the
+    // start of it. The mutex shall be held.
+    template <class Pred>
+    size_t partition_point(Pred pred) {
+        size_t first_len = std::min(count_, max_ - read_pos_);
+        T *first = buf_ + read_pos_;
+
+        if ((first_len == count_) || !pred(first[first_len - 1])) {
+            return std::partition_point(first, first + first_len, pred) - first;
+        }
+
+        return first_len + (std::partition_point(buf_, buf_ + (count_ - first_len), pred) - buf_);
+    }
+
+    // Does the bookkeeping after "num" elements have been removed. The mutex
+    // shall be held.
+    void popped(size_t num) {
+        pops_ += num;
+        if (hooks_ != 0) {
+            popped_hooked(num);
+        }
+        CIRCULARBUFFER_PROBE(pop_front, this, count_);
+    }
+
+    // The bookkeeping of the optional features after "num" elements have been
+    // removed. The mutex shall be held.
+    CIRCULARBUFFER_NOINLINE void popped_hooked(size_t num) {
+        if ((hooks_ & hook_budget) && (granted_ > reserved_) &&
+            (granted_ - count_ >= 2 * chunk_elems_)) {
+            return_chunks();
+        }
+        if ((hooks_ & hook_auto_trim) && (count_ == 0)) {
+            auto_trim();
+        }
+        if ((hooks_ & hook_watermarks) && (count_ <= low_mark_) && above_high_) {
+            cross_watermark(false);
+        }
+        if (hooks_ & hook_credits) {
+            return_credits(num);
+        }
+        if ((hooks_ & hook_selector) && (count_ == 0)) {
+            selector_->set_ready(selector_slot_, false);
+        }
+    }
+
+    // Returns the "num" slots freed by pop_front() or pop_batch() as credits,
+    // in batches. The mutex shall be held.
+    void return_credits(size_t num) {
+        pending_credits_ += num;
+        if ((pending_credits_ >= credit_batch_) || (count_ == 0)) {
+            credits_.fetch_add(pending_credits_, std::memory_order_release);
+            pending_credits_ = 0;
+        }
+    }
+
+    // Grows the buffer if it has been found full often enough in the current
+    // window. The mutex shall be held.
+    bool autotune_grow() {
+        if ((++window_full_ < autotune_.grow_after_full) || (max_ >= autotune_.max_capacity)) {
+            return false;
+        }
+        if (!reallocate(std::min(std::max<size_t>(max_ * 2, 1), autotune_.max_capacity))) {
+            return false;
+        }
+        window_full_ = 0;
+
+        return true;
+    }
+
+    // Tracks the peak occupancy of the window and shrinks the buffer after
+    // enough windows in a row with a low peak. The mutex shall be held.
+    void autotune_update() {
+        window_peak_ = std::max(window_peak_, count_);
+        if (++window_pushes_ < autotune_.window) {
+            return;
+        }
+
+        if ((max_ > autotune_.min_capacity) &&
+            (window_peak_ < autotune_.shrink_below * static_cast<double>(max_))) {
+            if (++low_windows_ >= autotune_.shrink_after_windows) {
+                reallocate(std::max(std::max(max_ / 2, autotune_.min_capacity), count_));
+                low_windows_ = 0;
+            }
+        } else {
+            low_windows_ = 0;
+        }
+
+        window_pushes_ = 0;
+        window_peak_ = count_;
+        window_full_ = 0;
+    }
+
+    void destroy_elements() {
+        for (size_t i = 0; i < count_; ++i) {
+            buf_[(read_pos_ + i) % max_].~T();
+        }
+    }
+
+    std::mutex mutex_;
+    T *buf_ = nullptr;                              // Pointer to the uninitialized buffer storage
+    size_t write_pos_ = 0;                          // Write pointer
+    size_t read_pos_ = 0;                           // Read pointer
+    size_t count_ = 0;                              // Number of added elements in the buffer
+    size_t max_;                                    // Max Number of elements in the buffer
+    uint32_t hooks_ = 0;                            // Enabled optional features, see the hook bits
+    bool mapped_ = false;                           // True if the storage is mapped with mmap()
+    bool locked_ = false;                           // True if the storage is locked with mlock()
+    size_t high_water_ = 0;                         // Highest number of elements in the buffer
+    uint64_t pushes_ = 0;                           // Number of added elements
+    uint64_t pops_ = 0;                             // Number of removed elements
+    uint64_t full_ = 0;                             // Number of rejected push_back() calls
+    uint64_t empty_ = 0;                            // Number of pop_front() calls when empty
+    bool registered_ = false;                       // True if added to the registry
+    std::vector<uint64_t> histogram_;               // Occupancy histogram, empty if disabled
+    size_t bucket_width_ = 1;                       // Number of occupancy levels per bucket
+    uint64_t samples_ = 0;                          // Number of push_back() calls while sampling
+    uint64_t sample_mask_ = 0;                      // Sample when (samples_ & sample_mask_) == 0
+    size_t histogram_buckets_ = 0;                  // Requested number of histogram buckets
+    circular_buffer_autotune autotune_;             // Adaptive capacity policy
+    bool autotune_enabled_ = false;                 // True if the capacity is adaptive
+    size_t window_pushes_ = 0;                      // Number of push_back() calls in the window
+    size_t window_peak_ = 0;                        // Highest number of elements in the window
+    size_t window_full_ = 0;                        // Number of full buffer hits in the window
+    size_t low_windows_ = 0;                        // Number of low occupancy windows in a row
+    size_t auto_trim_bytes_ = 0;                    // Written bytes that trigger an automatic trim
+    size_t touched_ = 0;                            // Extent written since the last trim
+    size_t granted_;                                // Usable elements, max_ without a budget
+    circular_buffer_budget *budget_ = nullptr;      // Shared memory budget or null
+    size_t reserved_ = 0;                           // Number of elements reserved in the budget
+    size_t chunk_elems_ = 1;                        // Number of elements per budget chunk
+    size_t high_mark_ = SIZE_MAX;                   // High watermark
+    size_t low_mark_ = 0;                           // Low watermark
+    std::atomic<bool> above_high_{false};           // True from a high to a low crossing
+    std::function<void(bool)> on_watermark_;
+    size_t credit_batch_ = 0;                       // Credits returned at a time, 0 if disabled
+    size_t pending_credits_ = 0;                    // Freed slots not yet returned as credits
+    std::atomic<size_t> credits_{0};
+    circular_buffer_selector *selector_ = nullptr;  // Selector waiting on the buffer or null
+    size_t selector_slot_ = 0;                      // Index of the buffer's bit in the ready mask
+    std::condition_variable batch_cond_;            // Signalled for the pop_batch() waiters
+    size_t batch_waiters_ = 0;                      // Number of threads blocked in pop_batch()
+    size_t batch_wake_ = SIZE_MAX;                  // Number of elements that wakes the waiters
+    size_t batch_size_ = 0;                         // Batch size of an adaptive_consumer or 0
+};
+
+/**
+ * @brief Producer side of the credit based flow control.
+ *
+ * Holds the credits of one producer thread and refills them from the buffer,
+ * see circular_buffer::enable_credits(). The elements are staged locally and
+ * added to the buffer under a single lock when "refill" of them have been
+ * staged, when the credits run out or on flush(). Staged elements are not
+ * visible to the consumer until then. The staged elements are flushed and
+ * the unused credits given back when destroyed.
+ */
+template <class T>
+class credit_producer {
+   public:
+    /**
+     * @brief The credit producer constructor.
+     *
+     * @param[in]   buf     The buffer to produce to.
+     * @param[in]   refill  Number of credits to take and elements to stage at
+     *                      a time.
+     */
+    credit_producer(circular_buffer<T> &buf, size_t refill)
+        : buf_(buf), refill_(std::max<size_t>(refill, 1)) {
+        staged_.reserve(refill_);
+    }
+
+    ~credit_producer() {
+        flush();
+        buf_.release_credits(credits_ + staged_.size());
+    }
+
+    credit_producer(const credit_producer &) = delete;
+    credit_producer &operator=(const credit_producer &) = delete;
+
+    /**
+     * @brief Stages a new element using a credit.
+     *
+     * @param[in]   val     Const reference to the source to be copied.
+     * @return              True if success, false if no credit is available
+     *                      or a memory budget refused the staged elements, in
+     *                      which case the credit is kept.
+     */
+    bool push_back(const T &val) {
+        if ((staged_.size() >= refill_) && !flush()) {
+            return false;
+        }
+        if ((credits_ == 0) && ((credits_ = buf_.acquire_credits(refill_)) == 0)) {
+            flush();
+            return false;
+        }
+        staged_.push_back(val);
+        --credits_;
+        if ((credits_ == 0) || (staged_.size() >= refill_)) {
+            flush();
+        }
+
+        return true;
+    }
+
+    /**
+     * @brief Adds the staged elements to the buffer under a single lock.
+     *
+     * @return              True if success, false if a memory budget refused
+     *                      some of them, which stay staged.
+     */
+    bool flush() {
+        if (staged_.empty()) {
+            return true;
+        }
+        const size_t num = buf_.push_batch(staged_.data(), staged_.size());
+        staged_.erase(staged_.begin(), staged_.begin() + static_cast<std::ptrdiff_t>(num));
+
+        return staged_.empty();
+    }
+
+    /**
+     * @brief Gets the number of unused credits held by the producer.
+     */
+    size_t credits() const { return credits_; };
+
+    /**
+     * @brief Gets the number of staged elements.
+     */
+    size_t staged() const { return staged_.size(); };
+
+   private:
+    circular_buffer<T> &buf_;  // The buffer to produce to
+    const size_t refill_;      // Number of credits to take at a time
+    size_t credits_ = 0;       // Number of unused credits held
+    std::vector<T> staged_;    // Elements not yet added to the buffer
+};
+
+/**
+ * @brief Consumer that adapts its drain batch size to a latency target.
+ *
+ * The arrival rate is measured from the number of elements that arrived
+ * between the batches, with older windows fading out. The queue residence
+ * time of the oldest element of each batch is estimated from the queue depth
+ * and the arrival rate (Little's law). The batch size is the number of
+ * elements that pop_batch() waits for, while up to the maximum batch size is
+ * drained. After each window of batches the batch size is halved if the p99
+ * residence time exceeds the target and the last batch emptied the buffer,
+ * and doubled if it is below half of the target. The current batch size is
+ * reported in circular_buffer::stats().
+ */
+template <class T>
+class adaptive_consumer {
+   public:
+    /**
+     * @brief The adaptive consumer constructor.
+     *
+     * @param[in]   buf     The buffer to consume from.
+     * @param[in]   policy  The batch size policy.
+     */
+    adaptive_consumer(circular_buffer<T> &buf,
+                      const circular_buffer_batching &policy = circular_buffer_batching())
+        : buf_(buf),
+          policy_(policy),
+          batch_(std::max<size_t>(policy.min_batch, 1)),
+          last_(std::chrono::steady_clock::now()) {
+        policy_.window = std::max<size_t>(policy_.window, 1);
+        samples_.reserve(policy_.window);
+        buf_.set_batch_size(batch_);
+    }
+
+    ~adaptive_consumer() { buf_.set_batch_size(0); }
+
+    adaptive_consumer(const adaptive_consumer &) = delete;
+    adaptive_consumer &operator=(const adaptive_consumer &) = delete;
+
+    /**
+     * @brief Removes a batch of elements from the buffer. Waits for the
+     * current batch size, but at most half of the target residence time, and
+     * then drains up to the maximum batch size so that a backlog is worked
+     * off in few synchronization steps.
+     *
+     * @param[out]  out     The destination of the elements.
+     * @return              The number of removed elements.
+     */
+    size_t pop_batch(std::vector<T> &out) {
+        auto deadline = std::chrono::steady_clock::now() + policy_.target / 2;
+        size_t num = buf_.pop_batch(out, batch_, policy_.max_batch, deadline);
+        if (num == 0) {
+            return 0;
+        }
+
+        // Estimate the arrival rate and the residence time of the oldest
+        // element from the queue depth before the batch was removed.
+        auto now = std::chrono::steady_clock::now();
+        size_t left = buf_.count();
+        size_t depth = num + left;
+        arrivals_ += depth - std::min(depth, left_);
+        left_ = left;
+        elapsed_ += now - last_;
+        last_ = now;
+        double rate = arrivals_ / std::max(elapsed_.count(), 1.0);
+        samples_.push_back(depth / std::max(rate, 1e-9));
+
+        if (samples_.size() == policy_.window) {
+            adjust();
+        }
+
+        return num;
+    }
+
+    /**
+     * @brief Gets the current batch size.
+     */
+    size_t batch_size() const { return batch_; };
+
+   private:
+    // Adjusts the batch size to the p99 residence time of the window.
+    void adjust() {
+        auto p99 = samples_.begin() + (samples_.size() * 99) / 100;
+        std::nth_element(samples_.begin(), p99, samples_.end());
+        double target = std::chrono::duration<double, std::nano>(policy_.target).count();
+
+        // A backlog is drained in full batches anyway, and waiting for fewer
+        // elements would not help it, so only shrink once it is gone.
+        if ((*p99 > target) && (left_ == 0)) {
+            batch_ = std::max(batch_ / 2, std::max<size_t>(policy_.min_batch, 1));
+        } else if (*p99 < target / 2) {
+            batch_ = std::max(batch_, std::min(batch_ * 2, policy_.max_batch));
+        }
+        buf_.set_batch_size(batch_);
+        samples_.clear();
+
+        // Age the arrival rate measurement.
+        arrivals_ /= 2;
+        elapsed_ /= 2;
+    }
+
+    circular_buffer<T> &buf_;                              // The buffer to consume from
+    circular_buffer_batching policy_;                      // Batch size policy
+    size_t batch_;                                         // Current batch size
+    std::chrono::steady_clock::time_point last_;           // End of the previous batch
+    std::chrono::duration<double, std::nano> elapsed_{0};  // Time covered by arrivals_
+    double arrivals_ = 0;                                  // Elements arrived within elapsed_
+    size_t left_ = 0;                                      // Elements left after the previous batch
+    std::vector<double> samples_;                          // Residence time estimates in ns
 };
 
 #endif /* CIRCULARBUFFER_H_ */
@@ -0,0 +1,141 @@
+/*
+ * MIT License (MIT)
+ *
+ * Copyright (c) 2019 Kristian Kinderlöv
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @addtogroup CIRCULARBUFFER
+ * @ingroup MISC
+ * @{
+ *
+ * @file        conflatingqueue.hpp
+ *
+ * @brief       Queue that replaces pending updates by key.
+ *
+ * The queue order is kept in a circular buffer of keys while the latest value
+ * of each pending key is kept in an index. An update for a key that is still
+ * pending overwrites the queued value and keeps its position, so a slow
+ * consumer processes at most one update per key.
+ */
+
+#ifndef CONFLATINGQUEUE_H_
+#define CONFLATINGQUEUE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+
+#include "circularbuffer.hpp"
+
+template <class Key, class T, class Hash = std::hash<Key>>
+class conflating_queue {
+   public:
+    /**
+     * @brief The conflating queue constructor.
+     *
+     * @param[in]   num     Maximum number of pending keys.
+     */
+    explicit conflating_queue(size_t num) : order_(num) { pending_.reserve(num); }
+
+    conflating_queue(const conflating_queue &) = delete;
+    conflating_queue &operator=(const conflating_queue &) = delete;
+
+    /**
+     * @brief Queues an update, or replaces the pending update for the key.
+     *
+     * @param[in]   key     The key of the update.
+     * @param[in]   value   The update.
+     * @return              True if success, false if the key is not pending
+     *                      and the queue is full.
+     */
+    bool push_back(const Key &key, const T &value) {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        auto it = pending_.find(key);
+        if (it != pending_.end()) {
+            it->second = value;
+            conflated_++;
+            return true;
+        }
+        if (!order_.push_back(key)) {
+            return false;
+        }
+        pending_.emplace(key, value);
+
+        return true;
+    }
+
+    /**
+     * @brief Removes the oldest pending key together with its latest update.
+     *
+     * @param[out]  key     The key of the update.
+     * @param[out]  value   The update.
+     * @return              True if success, false if the queue is empty.
+     */
+    bool pop_front(Key &key, T &value) {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        if (!order_.pop_front(key)) {
+            return false;
+        }
+        auto it = pending_.find(key);
+        value = std::move(it->second);
+        pending_.erase(it);
+
+        return true;
+    }
+
+    /**
+     * @brief Gets the number of pending keys.
+     *
+     * @return              The number of pending keys.
+     */
+    size_t count() {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        return pending_.size();
+    }
+
+    /**
+     * @brief Gets the number of updates that replaced a pending one.
+     *
+     * @return              The number of conflated updates.
+     */
+    uint64_t conflated() {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        return conflated_;
+    }
+
+   private:
+    std::mutex mutex_;
+    circular_buffer<Key> order_;                // Pending keys in queue order
+    std::unordered_map<Key, T, Hash> pending_;  // Latest update per pending key
+    uint64_t conflated_ = 0;                    // Number of replaced updates
+};
+
+#endif /* CONFLATINGQUEUE_H_ */
+
+/** @} */
@@ -0,0 +1,281 @@
+/*
+ * MIT License (MIT)
+ *
+ * Copyright (c) 2019 Kristian Kinderlöv
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @addtogroup CIRCULARBUFFER
+ * @ingroup MISC
+ * @{
+ *
+ * @file        jitterbuffer.hpp
+ *
+ * @brief       Jitter buffer for paced playout of media and sensor streams.
+ *
+ * Elements carry a sequence number and a sender timestamp. They are stored in
+ * a circular buffer of slots whose front is the slot of the next sequence
+ * number to play, so out of order arrivals within the capacity are put back
+ * in order. An element is due at its timestamp plus the smallest transit time
+ * seen plus a target delay. The target delay follows the interarrival jitter
+ * (RFC 3550) times a multiplier, within configured bounds. All times are in
+ * the same caller defined unit, e.g. microseconds. For thread safety
+ * std::mutex is used.
+ */
+
+#ifndef JITTERBUFFER_H_
+#define JITTERBUFFER_H_
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <utility>
+
+#include "circularbuffer.hpp"
+
+/**
+ * @brief Target delay policy, see jitter_buffer.
+ */
+struct jitter_buffer_config {
+    uint64_t min_delay = 0;           // Lower target delay bound
+    uint64_t max_delay = UINT64_MAX;  // Upper target delay bound
+    double multiplier = 4.0;          // Target delay in multiples of the jitter
+};
+
+/**
+ * @brief Statistics of a jitter buffer, see jitter_buffer::stats().
+ */
+struct jitter_buffer_stats {
+    uint64_t received = 0;      // Number of stored elements
+    uint64_t played = 0;        // Number of elements returned by pop_due()
+    uint64_t late = 0;          // Dropped, arrived after their slot was played or lost
+    uint64_t duplicates = 0;    // Dropped, their slot already held an element
+    uint64_t overflows = 0;     // Dropped, too far ahead of the playout
+    uint64_t lost = 0;          // Sequence numbers skipped without being played
+    uint64_t underruns = 0;     // Number of pop_due() calls on an empty buffer
+    double jitter = 0;          // Interarrival jitter estimate
+    uint64_t target_delay = 0;  // Current target delay
+};
+
+template <class T>
+class jitter_buffer {
+   public:
+    /**
+     * @brief The jitter buffer constructor.
+     *
+     * @param[in]   num     Number of sequence numbers that can be buffered,
+     *                      at least 1.
+     * @param[in]   config  The target delay policy.
+     */
+    explicit jitter_buffer(size_t num, const jitter_buffer_config &config = jitter_buffer_config())
+        : slots_(std::max<size_t>(num, 1)), config_(config), target_(config.min_delay) {
+        while (slots_.space() > 0) {
+            slots_.push_back(slot());
+        }
+    }
+
+    jitter_buffer(const jitter_buffer &) = delete;
+    jitter_buffer &operator=(const jitter_buffer &) = delete;
+
+    /**
+     * @brief Stores an arrived element.
+     *
+     * @param[in]   seq         The sequence number.
+     * @param[in]   timestamp   The sender timestamp.
+     * @param[in]   arrival     The arrival time.
+     * @param[in]   val         The element.
+     * @return                  True if success, false if the element was
+     *                          dropped as late, duplicate or too far ahead.
+     */
+    bool push(uint64_t seq, uint64_t timestamp, uint64_t arrival, const T &val) {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        int64_t transit = static_cast<int64_t>(arrival - timestamp);
+        if (!started_) {
+            started_ = true;
+            next_ = seq;
+            base_transit_ = transit;
+        } else {
+            // Interarrival jitter, RFC 3550 section 6.4.1.
+            double d = std::fabs(static_cast<double>(transit - last_transit_));
+            stats_.jitter += (d - stats_.jitter) / 16;
+            base_transit_ = std::min(base_transit_, transit);
+            double target = config_.multiplier * stats_.jitter;
+            if (target >= static_cast<double>(config_.max_delay)) {
+                target_ = config_.max_delay;
+            } else {
+                target_ = std::max(static_cast<uint64_t>(std::max(target, 0.0)), config_.min_delay);
+            }
+        }
+        last_transit_ = transit;
+
+        if (seq < next_) {
+            ++stats_.late;
+            return false;
+        }
+        if (seq - next_ >= slots_.count()) {
+            // Resynchronize after a loss burst longer than the capacity,
+            // otherwise drop the element as too far ahead.
+            if ((count_ != 0) && (seq - newest_ <= slots_.count())) {
+                ++stats_.overflows;
+                return false;
+            }
+            resync(seq - slots_.count() + 1);
+        }
+        slot *s = at(static_cast<size_t>(seq - next_));
+        if (s->filled) {
+            ++stats_.duplicates;
+            return false;
+        }
+        s->value = val;
+        s->timestamp = timestamp;
+        s->filled = true;
+        newest_ = (count_ == 0) ? seq : std::max(newest_, seq);
+        ++count_;
+        ++stats_.received;
+
+        return true;
+    }
+
+    /**
+     * @brief Removes the next element if it is due. Sequence numbers that are
+     * missing when a later element is due are skipped as lost.
+     *
+     * @param[in]   now     The current time.
+     * @param[out]  val     The element.
+     * @return              True if success, false if no element is due.
+     */
+    bool pop_due(uint64_t now, T &val) {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        if (count_ == 0) {
+            ++stats_.underruns;
+            return false;
+        }
+
+        // Skip the missing sequence numbers before a due element.
+        size_t offset = 0;
+        while (!at(offset)->filled) {
+            ++offset;
+        }
+        if (!due(*at(offset), now)) {
+            return false;
+        }
+        for (; offset > 0; offset--) {
+            advance();
+            ++stats_.lost;
+        }
+
+        slot *s = at(0);
+        val = std::move(s->value);
+        s->value = T();
+        s->filled = false;
+        --count_;
+        ++stats_.played;
+        advance();
+
+        return true;
+    }
+
+    /**
+     * @brief Gets a snapshot of the statistics.
+     *
+     * @return              The jitter buffer statistics.
+     */
+    jitter_buffer_stats stats() {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        jitter_buffer_stats s = stats_;
+        s.target_delay = target_;
+
+        return s;
+    }
+
+    /**
+     * @brief Gets the number of buffered elements.
+     */
+    size_t count() {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        return count_;
+    }
+
+   private:
+    struct slot {
+        T value = T();
+        uint64_t timestamp = 0;  // Sender timestamp
+        bool filled = false;     // True if the slot holds an element
+    };
+
+    // Gets the slot "offset" sequence numbers after the next one.
+    slot *at(size_t offset) {
+        slot *s = nullptr;
+        slots_.peek(offset, s);
+
+        return s;
+    }
+
+    bool due(const slot &s, uint64_t now) const {
+        return static_cast<int64_t>(now - s.timestamp - target_) >= base_transit_;
+    }
+
+    // Moves the playout to the next sequence number. The front slot is empty.
+    void advance() {
+        slot s;
+        slots_.pop_front(s);
+        slots_.push_back(s);
+        ++next_;
+    }
+
+    // Moves the playout forward to "seq", dropping the elements before it.
+    void resync(uint64_t seq) {
+        uint64_t skip = seq - next_;
+        for (size_t i = 0; (i < skip) && (count_ != 0); i++) {
+            slot *s = at(0);
+            if (s->filled) {
+                s->value = T();
+                s->filled = false;
+                --count_;
+            }
+            advance();
+        }
+        stats_.lost += skip;
+        next_ = seq;
+    }
+
+    std::mutex mutex_;
+    circular_buffer<slot> slots_;  // Slots from the next sequence number on
+    jitter_buffer_config config_;  // Target delay policy
+    jitter_buffer_stats stats_;    // Statistics, but the target delay
+    uint64_t target_;              // Current target delay
+    bool started_ = false;         // True after the first element
+    uint64_t next_ = 0;            // Next sequence number to play
+    uint64_t newest_ = 0;          // Highest buffered sequence number
+    int64_t base_transit_ = 0;     // Smallest transit time seen
+    int64_t last_transit_ = 0;     // Transit time of the last element
+    size_t count_ = 0;             // Number of buffered elements
+};
+
+#endif /* JITTERBUFFER_H_ */
+
+/** @} */
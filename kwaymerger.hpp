@@ -0,0 +1,196 @@
+/*
+ * MIT License (MIT)
+ *
+ * Copyright (c) 2019 Kristian Kinderlöv
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @addtogroup CIRCULARBUFFER
+ * @ingroup MISC
+ * @{
+ *
+ * @file        kwaymerger.hpp
+ *
+ * @brief       Timestamp ordered k-way merge of circular buffers.
+ *
+ * Merges the elements of a set of circular buffers, e.g. one per producer
+ * thread, into one stream ordered by a key such as a timestamp or a sequence
+ * number. The heads of the buffers are kept in a tournament tree, so emitting
+ * an element costs O(log N) for N buffers. The merger shall be the only
+ * consumer of the buffers.
+ */
+
+#ifndef KWAYMERGER_H_
+#define KWAYMERGER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "circularbuffer.hpp"
+
+template <class T, class KeyOf>
+class kway_merger {
+   public:
+    typedef typename std::decay<decltype(std::declval<KeyOf>()(std::declval<const T &>()))>::type
+        key_type;
+
+    /**
+     * @brief The k-way merger constructor.
+     *
+     * An empty buffer may still receive an element with a smaller key than
+     * the heads of the other buffers. The merger therefore only emits an
+     * element while any buffer is empty once the element is at least
+     * "max_lateness" older than the current time. Elements that arrive after
+     * a newer element has been emitted are dropped and counted as late.
+     *
+     * @param[in]   sources         The buffers to merge, elements within each
+     *                              buffer shall be in key order.
+     * @param[in]   max_lateness    The bounded lateness of the watermark, in
+     *                              key units.
+     * @param[in]   key_of          Gets the key of an element.
+     */
+    kway_merger(const std::vector<circular_buffer<T> *> &sources, key_type max_lateness,
+                KeyOf key_of = KeyOf())
+        : sources_(sources), max_lateness_(max_lateness), key_of_(key_of) {
+        leaves_ = 1;
+        while (leaves_ < sources_.size()) {
+            leaves_ <<= 1;
+        }
+        heads_.resize(sources_.size());
+        valid_.assign(sources_.size(), false);
+        tree_.assign(2 * leaves_, npos);
+    }
+
+    /**
+     * @brief Removes the element with the smallest key.
+     *
+     * Without a current time the merger waits until every buffer has data.
+     *
+     * @param[out]  val     Reference to the destination where the element is
+     *                      to be stored.
+     * @return              True if success, false if no element can be
+     *                      emitted yet.
+     */
+    bool pop_front(T &val) { return pop(val, false, key_type()); }
+
+    /**
+     * @brief Removes the element with the smallest key, or waits for the
+     * watermark when a buffer is empty.
+     *
+     * @param[out]  val     Reference to the destination where the element is
+     *                      to be stored.
+     * @param[in]   now     The current time in key units.
+     * @return              True if success, false if no element can be
+     *                      emitted yet.
+     */
+    bool pop_front(T &val, key_type now) { return pop(val, true, now); }
+
+    /**
+     * @brief Gets the number of dropped late elements.
+     */
+    uint64_t late() const { return late_; };
+
+   private:
+    enum : size_t { npos = SIZE_MAX };
+
+    bool pop(T &val, bool watermark, key_type now) {
+        for (;;) {
+            bool idle = false;
+            for (size_t i = 0; i < sources_.size(); ++i) {
+                if (!valid_[i] && !refresh(i)) {
+                    idle = true;
+                }
+            }
+
+            const size_t winner = tree_[1];
+            if (winner == npos) {
+                return false;
+            }
+            if (idle && (!watermark || (now < heads_[winner] + max_lateness_))) {
+                return false;
+            }
+
+            sources_[winner]->pop_front(val);
+            valid_[winner] = false;
+            update(winner);
+
+            if (emitted_ && (heads_[winner] < last_)) {
+                ++late_;
+                continue;
+            }
+            last_ = heads_[winner];
+            emitted_ = true;
+
+            return true;
+        }
+    }
+
+    // Reads the head of an empty source and updates the tree if it has data.
+    bool refresh(size_t i) {
+        T *head;
+
+        if (!sources_[i]->peek(0, head)) {
+            return false;
+        }
+        heads_[i] = key_of_(*head);
+        valid_[i] = true;
+        update(i);
+
+        return true;
+    }
+
+    // Replays the matches from the leaf of source "i" up to the root.
+    void update(size_t i) {
+        size_t node = leaves_ + i;
+
+        tree_[node] = valid_[i] ? i : npos;
+        for (node >>= 1; node > 0; node >>= 1) {
+            const size_t a = tree_[2 * node];
+            const size_t b = tree_[2 * node + 1];
+
+            if (a == npos) {
+                tree_[node] = b;
+            } else if (b == npos) {
+                tree_[node] = a;
+            } else {
+                tree_[node] = (heads_[b] < heads_[a]) ? b : a;
+            }
+        }
+    }
+
+    std::vector<circular_buffer<T> *> sources_;  // The merged buffers
+    const key_type max_lateness_;                // Bounded lateness of the watermark
+    KeyOf key_of_;                               // Gets the key of an element
+    size_t leaves_;                              // Number of leaves of the tree
+    std::vector<key_type> heads_;                // Keys of the source heads
+    std::vector<bool> valid_;                    // True if the head key is read
+    std::vector<size_t> tree_;                   // Winner source of each match
+    key_type last_ = key_type();                 // Key of the last emitted element
+    bool emitted_ = false;                       // True if an element is emitted
+    uint64_t late_ = 0;                          // Number of dropped late elements
+};
+
+#endif /* KWAYMERGER_H_ */
+
+/** @} */
@@ -0,0 +1,168 @@
+/*
+ * MIT License (MIT)
+ *
+ * Copyright (c) 2019 Kristian Kinderlöv
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @addtogroup CIRCULARBUFFER
+ * @ingroup MISC
+ * @{
+ *
+ * @file        pingpongbuffer.hpp
+ *
+ * @brief       Double buffer for handing over whole batches.
+ *
+ * The producer fills one circular buffer while the consumer drains the other
+ * one. A swap hands the filled half over to the consumer and gives the
+ * drained half back to the producer by exchanging two pointers, so the cost
+ * is O(1) regardless of the batch size and the halves are never shared
+ * between the threads while they are being filled or drained.
+ */
+
+#ifndef PINGPONGBUFFER_H_
+#define PINGPONGBUFFER_H_
+
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <utility>
+
+#include "circularbuffer.hpp"
+
+template <class T>
+class ping_pong_buffer {
+   public:
+    /**
+     * @brief The ping-pong buffer constructor.
+     *
+     * @param[in]   num     Number of elements that each half can hold.
+     */
+    explicit ping_pong_buffer(size_t num) : ping_(num), pong_(num) {
+        // Do nothing.
+    }
+
+    ping_pong_buffer(const ping_pong_buffer &) = delete;
+    ping_pong_buffer &operator=(const ping_pong_buffer &) = delete;
+
+    /**
+     * @brief Gets the half that the producer fills. Shall only be used by the
+     * producer thread, and only until the next swap.
+     *
+     * @return              The producer half.
+     */
+    circular_buffer<T> &producer_half() {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        return *producer_;
+    }
+
+    /**
+     * @brief Hands the producer half over to the consumer, without blocking.
+     *
+     * @return              True if success, false if the consumer has not
+     *                      drained and released its half yet or if the
+     *                      producer half is empty.
+     */
+    bool try_swap() {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        if (published_ || producer_->empty()) {
+            return false;
+        }
+        publish();
+
+        return true;
+    }
+
+    /**
+     * @brief Hands the producer half over to the consumer. Blocks until the
+     * consumer has released its half.
+     *
+     * @return              The new producer half, which is empty.
+     */
+    circular_buffer<T> &swap() {
+        std::unique_lock<std::mutex> lock(mutex_);
+
+        cond_.wait(lock, [this]() { return !published_; });
+        publish();
+
+        return *producer_;
+    }
+
+    /**
+     * @brief Waits for a batch from the producer.
+     *
+     * @return              The consumer half holding the batch. Shall only
+     *                      be used by the consumer thread until release().
+     */
+    circular_buffer<T> &acquire() {
+        std::unique_lock<std::mutex> lock(mutex_);
+
+        cond_.wait(lock, [this]() { return published_; });
+
+        return *consumer_;
+    }
+
+    /**
+     * @brief Gets a batch from the producer without blocking.
+     *
+     * @return              The consumer half holding the batch, null if no
+     *                      batch has been handed over.
+     */
+    circular_buffer<T> *try_acquire() {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        return published_ ? consumer_ : nullptr;
+    }
+
+    /**
+     * @brief Gives the drained consumer half back for the next swap. Elements
+     * that are left in the half are removed.
+     */
+    void release() {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        consumer_->clear();
+        published_ = false;
+        cond_.notify_all();
+    }
+
+   private:
+    // Exchanges the halves. The mutex shall be held.
+    void publish() {
+        std::swap(producer_, consumer_);
+        published_ = true;
+        cond_.notify_all();
+    }
+
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    circular_buffer<T> ping_;                // The first half
+    circular_buffer<T> pong_;                // The second half
+    circular_buffer<T> *producer_ = &ping_;  // The half being filled
+    circular_buffer<T> *consumer_ = &pong_;  // The half being drained
+    bool published_ = false;                 // True if the consumer half holds a batch
+};
+
+#endif /* PINGPONGBUFFER_H_ */
+
+/** @} */
@@ -0,0 +1,165 @@
+/*
+ * MIT License (MIT)
+ *
+ * Copyright (c) 2019 Kristian Kinderlöv
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @addtogroup CIRCULARBUFFER
+ * @ingroup MISC
+ * @{
+ *
+ * @file        reorderbuffer.hpp
+ *
+ * @brief       Reorder buffer for out of order completions.
+ *
+ * A ring of slots indexed by sequence number modulo the capacity. Completions
+ * are stored in their slot in any order and drain() releases the longest run
+ * of consecutive sequence numbers from the next expected one, so each element
+ * costs O(1). For thread safety std::mutex is used.
+ */
+
+#ifndef REORDERBUFFER_H_
+#define REORDERBUFFER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+template <class T>
+class reorder_buffer {
+   public:
+    /**
+     * @brief The reorder buffer constructor.
+     *
+     * @param[in]   num     Number of sequence numbers that can be in flight,
+     *                      rounded up to a power of two.
+     * @param[in]   first   The first sequence number.
+     */
+    explicit reorder_buffer(size_t num, uint64_t first = 0) : next_(first) {
+        size_t size = 1;
+        while (size < num) {
+            size <<= 1;
+        }
+        slots_.resize(size);
+        filled_.resize(size, false);
+        mask_ = size - 1;
+    }
+
+    reorder_buffer(const reorder_buffer &) = delete;
+    reorder_buffer &operator=(const reorder_buffer &) = delete;
+
+    /**
+     * @brief Stores a completion in the slot of its sequence number.
+     *
+     * @param[in]   seq     The sequence number.
+     * @param[in]   val     The completion.
+     * @return              True if success, false if the sequence number has
+     *                      already been stored or released, or is too far
+     *                      ahead of the next expected one.
+     */
+    bool insert(uint64_t seq, const T &val) {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        if ((seq < next_) || (seq - next_ > mask_) || filled_[seq & mask_]) {
+            return false;
+        }
+        slots_[seq & mask_] = val;
+        filled_[seq & mask_] = true;
+        ++count_;
+
+        return true;
+    }
+
+    /**
+     * @brief Releases the completions from the next expected sequence number
+     * up to the first missing one.
+     *
+     * @param[out]  out     The completions are added at the end, in sequence
+     *                      order.
+     * @return              The number of released completions.
+     */
+    size_t drain(std::vector<T> &out) {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        size_t num = 0;
+        while (filled_[next_ & mask_]) {
+            out.push_back(std::move(slots_[next_ & mask_]));
+            filled_[next_ & mask_] = false;
+            ++next_;
+            ++num;
+        }
+        count_ -= num;
+
+        return num;
+    }
+
+    /**
+     * @brief Skips a sequence number that will never complete. Completions
+     * after it can then be released.
+     *
+     * @return              True if success, false if the next expected
+     *                      sequence number has already been stored.
+     */
+    bool skip() {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        if (filled_[next_ & mask_]) {
+            return false;
+        }
+        ++next_;
+
+        return true;
+    }
+
+    /**
+     * @brief Gets the next expected sequence number.
+     */
+    uint64_t next() {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        return next_;
+    }
+
+    /**
+     * @brief Gets the number of stored completions that wait for a missing
+     * sequence number.
+     */
+    size_t count() {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        return count_;
+    }
+
+   private:
+    std::mutex mutex_;
+    std::vector<T> slots_;      // Completions indexed by sequence number
+    std::vector<bool> filled_;  // True if the slot holds a completion
+    uint64_t mask_ = 0;         // Number of slots minus one
+    uint64_t next_;             // Next sequence number to release
+    size_t count_ = 0;          // Number of stored completions
+};
+
+#endif /* REORDERBUFFER_H_ */
+
+/** @} */
@@ -0,0 +1,217 @@
+/*
+ * MIT License (MIT)
+ *
+ * Copyright (c) 2019 Kristian Kinderlöv
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @addtogroup CIRCULARBUFFER
+ * @ingroup MISC
+ * @{
+ *
+ * @file        roundrobinarchive.hpp
+ *
+ * @brief       Multi-resolution round-robin time series store.
+ *
+ * A time series is kept in tiers of increasing bucket width, e.g. 1 s, 1 min
+ * and 1 h, each a circular buffer of consolidated rows where the oldest row
+ * is dropped when a new one is added. Samples are accumulated into the bucket
+ * of the finest tier, and a completed row is accumulated into the bucket of
+ * the next tier, so each sample costs O(1) per tier and the memory is fixed.
+ * A bucket is completed by the first sample or row beyond it. For thread
+ * safety std::mutex is used.
+ */
+
+#ifndef ROUNDROBINARCHIVE_H_
+#define ROUNDROBINARCHIVE_H_
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "circularbuffer.hpp"
+
+/**
+ * @brief Consolidated row of a round-robin archive tier.
+ */
+struct round_robin_row {
+    uint64_t start = 0;  // Start time of the bucket
+    uint64_t count = 0;  // Number of samples in the bucket
+    double avg = 0;      // Average of the samples
+    double min = 0;      // Smallest sample
+    double max = 0;      // Largest sample
+    double last = 0;     // Latest sample
+};
+
+class round_robin_archive {
+   public:
+    /**
+     * @brief Bucket width and number of rows of a tier.
+     */
+    struct tier_config {
+        uint64_t step;  // Bucket width, a multiple of the previous tier's
+        size_t rows;    // Number of rows kept
+    };
+
+    /**
+     * @brief The round-robin archive constructor.
+     *
+     * @param[in]   tiers   The tiers, from the finest to the coarsest.
+     */
+    explicit round_robin_archive(const std::vector<tier_config> &tiers) {
+        for (const auto &config : tiers) {
+            tiers_.emplace_back(new tier(config));
+        }
+    }
+
+    round_robin_archive(const round_robin_archive &) = delete;
+    round_robin_archive &operator=(const round_robin_archive &) = delete;
+
+    /**
+     * @brief Adds a sample.
+     *
+     * @param[in]   time    The sample time, not before the bucket of the
+     *                      previous sample.
+     * @param[in]   value   The sample value.
+     * @return              True if success, false if the sample is too old.
+     */
+    bool push_back(uint64_t time, double value) {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        if (tiers_.empty() || (started_ && (time < tiers_[0]->bucket.start))) {
+            return false;
+        }
+        started_ = true;
+
+        round_robin_row sample;
+        sample.start = time;
+        sample.count = 1;
+        sample.avg = sample.min = sample.max = sample.last = value;
+        consolidate(0, sample);
+
+        return true;
+    }
+
+    /**
+     * @brief Gets the completed rows of a tier, from the oldest to the latest.
+     *
+     * @param[in]   num     The tier index.
+     * @param[out]  rows    The rows are added at the end.
+     * @return              The number of rows.
+     */
+    size_t fetch(size_t num, std::vector<round_robin_row> &rows) {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        if (num >= tiers_.size()) {
+            return 0;
+        }
+        circular_buffer<round_robin_row> &ring = tiers_[num]->rows;
+        size_t count = ring.count();
+        for (size_t i = 0; i < count; i++) {
+            round_robin_row *row = nullptr;
+            ring.peek(i, row);
+            rows.push_back(*row);
+        }
+
+        return count;
+    }
+
+    /**
+     * @brief Gets the bucket of a tier that is still being accumulated.
+     *
+     * @param[in]   num     The tier index.
+     * @param[out]  row     The bucket so far.
+     * @return              True if success, false if the bucket is empty.
+     */
+    bool current(size_t num, round_robin_row &row) {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        if ((num >= tiers_.size()) || (tiers_[num]->bucket.count == 0)) {
+            return false;
+        }
+        row = tiers_[num]->bucket;
+        row.avg = tiers_[num]->sum / row.count;
+
+        return true;
+    }
+
+    /**
+     * @brief Gets the number of tiers.
+     */
+    size_t tiers() const { return tiers_.size(); };
+
+   private:
+    struct tier {
+        explicit tier(const tier_config &config)
+            : step(std::max<uint64_t>(config.step, 1)), rows(std::max<size_t>(config.rows, 1)) {
+            // Do nothing.
+        }
+
+        const uint64_t step;                    // Bucket width
+        circular_buffer<round_robin_row> rows;  // Completed rows
+        round_robin_row bucket;                 // Bucket being accumulated
+        double sum = 0;                         // Weighted sum of the bucket
+    };
+
+    // Accumulates a sample or a completed row into the bucket of a tier,
+    // completing the bucket first if the row is beyond it.
+    void consolidate(size_t num, const round_robin_row &in) {
+        tier &t = *tiers_[num];
+        uint64_t start = in.start - in.start % t.step;
+
+        if ((t.bucket.count != 0) && (start != t.bucket.start)) {
+            round_robin_row done = t.bucket;
+            done.avg = t.sum / done.count;
+            if (t.rows.space() == 0) {
+                round_robin_row oldest;
+                t.rows.pop_front(oldest);
+            }
+            t.rows.push_back(done);
+            t.bucket.count = 0;
+            if (num + 1 < tiers_.size()) {
+                consolidate(num + 1, done);
+            }
+        }
+
+        if (t.bucket.count == 0) {
+            t.bucket = in;
+            t.bucket.start = start;
+            t.sum = in.avg * in.count;
+        } else {
+            t.bucket.count += in.count;
+            t.bucket.min = std::min(t.bucket.min, in.min);
+            t.bucket.max = std::max(t.bucket.max, in.max);
+            t.bucket.last = in.last;
+            t.sum += in.avg * in.count;
+        }
+    }
+
+    std::mutex mutex_;
+    std::vector<std::unique_ptr<tier>> tiers_;  // From the finest to the coarsest
+    bool started_ = false;                      // True after the first sample
+};
+
+#endif /* ROUNDROBINARCHIVE_H_ */
+
+/** @} */
@@ -0,0 +1,355 @@
+/*
+ * MIT License (MIT)
+ *
+ * Copyright (c) 2019 Kristian Kinderlöv
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @addtogroup CIRCULARBUFFER
+ * @ingroup MISC
+ * @{
+ *
+ * @file        s3fifocache.hpp
+ *
+ * @brief       Bounded key-value cache with S3-FIFO eviction.
+ *
+ * New entries are queued in a small FIFO queue and entries that were hit
+ * while in it are moved to the main FIFO queue, where CLOCK reinsertion keeps
+ * the entries that are hit. Entries evicted from the small queue leave their
+ * key in a ghost FIFO queue, and a key that is inserted again while a ghost
+ * goes straight to the main queue. The queues are circular buffers of entry
+ * indices and the entries are found through an open addressing hash index. A
+ * hit only sets the reference count of the entry, so it touches no queue. With
+ * a small queue fraction of zero the cache is plain CLOCK. The cache is not
+ * thread safe and Key and T shall be default constructible.
+ */
+
+#ifndef S3FIFOCACHE_H_
+#define S3FIFOCACHE_H_
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "circularbuffer.hpp"
+
+template <class Key, class T, class Hash = std::hash<Key>>
+class s3fifo_cache {
+   public:
+    /**
+     * @brief The cache constructor.
+     *
+     * @param[in]   capacity        Maximum number of cached entries.
+     * @param[in]   small_fraction  Part of the capacity used for the small
+     *                              queue, 0 for plain CLOCK.
+     */
+    explicit s3fifo_cache(size_t capacity, double small_fraction = 0.1)
+        : capacity_(std::max<size_t>(capacity, 1)),
+          small_target_(std::min(static_cast<size_t>(capacity_ * std::max(small_fraction, 0.0)),
+                                 capacity_)),
+          small_(capacity_),
+          main_(capacity_),
+          ghost_(std::max<size_t>(capacity_ - small_target_, 1)) {
+        // Room for the cached entries and the ghosts.
+        entries_.resize(capacity_ + ghost_.space());
+        for (size_t i = 0; i < entries_.size(); i++) {
+            entries_[i].next_free = static_cast<uint32_t>(i + 1);
+        }
+        entries_.back().next_free = nil;
+        free_ = 0;
+
+        size_t size = 1;
+        while (size < 2 * entries_.size()) {
+            size <<= 1;
+        }
+        index_.assign(size, nil);
+        mask_ = size - 1;
+    }
+
+    s3fifo_cache(const s3fifo_cache &) = delete;
+    s3fifo_cache &operator=(const s3fifo_cache &) = delete;
+
+    /**
+     * @brief Looks up a key.
+     *
+     * @param[in]   key     The key.
+     * @return              Pointer to the cached value, valid until the next
+     *                      insert() or erase(), null on a miss.
+     */
+    T *find(const Key &key) {
+        size_t pos = lookup(key, hash_(key));
+        if ((pos == npos) || (entries_[index_[pos]].state == ghost)) {
+            ++misses_;
+            return nullptr;
+        }
+        entry &e = entries_[index_[pos]];
+        e.freq = std::min<uint8_t>(e.freq + 1, max_freq);
+        ++hits_;
+
+        return &e.value;
+    }
+
+    /**
+     * @brief Inserts a value, or replaces the cached value of the key.
+     * Evicts an entry when the cache is full.
+     *
+     * @param[in]   key     The key.
+     * @param[in]   val     The value.
+     * @return              True if inserted, false if replaced.
+     */
+    bool insert(const Key &key, const T &val) {
+        size_t hash = hash_(key);
+        size_t pos = lookup(key, hash);
+        if ((pos != npos) && (entries_[index_[pos]].state != ghost)) {
+            entries_[index_[pos]].value = val;
+            return false;
+        }
+
+        // Evicting may release the ghost of the key or move it in the index.
+        if (resident_ >= capacity_) {
+            while (resident_ >= capacity_) {
+                evict();
+            }
+            pos = lookup(key, hash);
+        }
+
+        uint32_t id;
+        if (pos != npos) {
+            // Reinserted while a ghost, the ghost queue slot goes stale.
+            id = index_[pos];
+            ++entries_[id].generation;
+        } else {
+            id = allocate();
+            entries_[id].key = key;
+            entries_[id].hash = hash;
+            link(id);
+        }
+        entry &e = entries_[id];
+        e.value = val;
+        e.freq = 0;
+        ++resident_;
+        ++size_;
+        if ((pos != npos) || (small_target_ == 0)) {
+            e.state = in_main;
+            push_main(id);
+        } else {
+            e.state = in_small;
+            small_.push_back(id);
+        }
+
+        return true;
+    }
+
+    /**
+     * @brief Removes a key. The entry is reclaimed when it reaches the end
+     * of its queue.
+     *
+     * @param[in]   key     The key.
+     * @return              True if success, false if the key is not cached.
+     */
+    bool erase(const Key &key) {
+        size_t pos = lookup(key, hash_(key));
+        if ((pos == npos) || (entries_[index_[pos]].state == ghost)) {
+            return false;
+        }
+        entry &e = entries_[index_[pos]];
+        e.state = erased;
+        e.value = T();
+        unlink(pos);
+        --size_;
+
+        return true;
+    }
+
+    /**
+     * @brief Gets the number of cached entries.
+     */
+    size_t size() const { return size_; };
+
+    /**
+     * @brief Gets the number of find() calls that hit.
+     */
+    uint64_t hits() const { return hits_; };
+
+    /**
+     * @brief Gets the number of find() calls that missed.
+     */
+    uint64_t misses() const { return misses_; };
+
+   private:
+    enum : uint32_t { nil = UINT32_MAX };
+    enum : size_t { npos = SIZE_MAX };
+    enum : uint8_t { max_freq = 3 };
+    enum state_type : uint8_t { unused, in_small, in_main, ghost, erased };
+
+    struct entry {
+        Key key = Key();
+        T value = T();
+        size_t hash = 0;            // Hash of the key
+        uint32_t next_free = nil;   // Next unused entry
+        uint32_t generation = 0;    // Incremented when leaving the ghost queue
+        uint8_t freq = 0;           // Reference count, saturates at max_freq
+        state_type state = unused;  // Queue that holds the entry
+    };
+
+    // Gets the index position of a key, npos if not found.
+    size_t lookup(const Key &key, size_t hash) const {
+        for (size_t pos = hash & mask_; index_[pos] != nil; pos = (pos + 1) & mask_) {
+            const entry &e = entries_[index_[pos]];
+            if ((e.hash == hash) && (e.key == key)) {
+                return pos;
+            }
+        }
+
+        return npos;
+    }
+
+    void link(uint32_t id) {
+        size_t pos = entries_[id].hash & mask_;
+        while (index_[pos] != nil) {
+            pos = (pos + 1) & mask_;
+        }
+        index_[pos] = id;
+    }
+
+    // Removes an index position, shifting the following probe sequence back
+    // instead of leaving a tombstone.
+    void unlink(size_t pos) {
+        for (size_t next = (pos + 1) & mask_; index_[next] != nil; next = (next + 1) & mask_) {
+            size_t home = entries_[index_[next]].hash & mask_;
+            if (((next - home) & mask_) >= ((next - pos) & mask_)) {
+                index_[pos] = index_[next];
+                pos = next;
+            }
+        }
+        index_[pos] = nil;
+    }
+
+    uint32_t allocate() {
+        uint32_t id = free_;
+        free_ = entries_[id].next_free;
+
+        return id;
+    }
+
+    void release(uint32_t id) {
+        entry &e = entries_[id];
+        if (e.state == ghost) {
+            unlink(lookup(e.key, e.hash));
+        }
+        e.key = Key();
+        e.value = T();
+        e.state = unused;
+        e.next_free = free_;
+        free_ = id;
+    }
+
+    // Evicts from the small queue when it has reached its share, otherwise
+    // from the main queue. May only move an entry between the queues.
+    void evict() {
+        if ((small_.count() > 0) && ((small_.count() >= small_target_) || main_.empty())) {
+            evict_small();
+        } else {
+            evict_main();
+        }
+    }
+
+    void evict_small() {
+        uint32_t id = nil;
+        if (!small_.pop_front(id)) {
+            return;
+        }
+        entry &e = entries_[id];
+        if (e.state == erased) {
+            --resident_;
+            release(id);
+        } else if (e.freq > 0) {
+            e.freq = 0;
+            e.state = in_main;
+            push_main(id);
+        } else {
+            e.state = ghost;
+            e.value = T();
+            --resident_;
+            --size_;
+            push_ghost(id);
+        }
+    }
+
+    // CLOCK: entries that were hit get another round with a lower count.
+    void evict_main() {
+        uint32_t id = nil;
+        if (!main_.pop_front(id)) {
+            return;
+        }
+        entry &e = entries_[id];
+        if ((e.state != erased) && (e.freq > 0)) {
+            --e.freq;
+            main_.push_back(id);
+            return;
+        }
+        if (e.state != erased) {
+            unlink(lookup(e.key, e.hash));
+            --size_;
+        }
+        --resident_;
+        release(id);
+    }
+
+    void push_main(uint32_t id) {
+        while (main_.space() == 0) {
+            evict_main();
+        }
+        main_.push_back(id);
+    }
+
+    void push_ghost(uint32_t id) {
+        uint64_t oldest = 0;
+        if ((ghost_.space() == 0) && ghost_.pop_front(oldest)) {
+            uint32_t old = static_cast<uint32_t>(oldest);
+            if ((entries_[old].state == ghost) && (entries_[old].generation == (oldest >> 32))) {
+                release(old);
+            }
+        }
+        ghost_.push_back((static_cast<uint64_t>(entries_[id].generation) << 32) | id);
+    }
+
+    const size_t capacity_;            // Maximum number of cached entries
+    const size_t small_target_;        // Share of the small queue
+    circular_buffer<uint32_t> small_;  // Small FIFO queue of entry indices
+    circular_buffer<uint32_t> main_;   // Main FIFO queue of entry indices
+    circular_buffer<uint64_t> ghost_;  // Ghost FIFO queue of generations and indices
+    std::vector<entry> entries_;       // Entry pool
+    std::vector<uint32_t> index_;      // Open addressing hash index of entries
+    size_t mask_ = 0;                  // Index size minus one
+    uint32_t free_ = nil;              // First unused entry
+    size_t resident_ = 0;              // Entries in the small and main queues
+    size_t size_ = 0;                  // Number of cached entries
+    uint64_t hits_ = 0;                // Number of hits
+    uint64_t misses_ = 0;              // Number of misses
+    Hash hash_;
+};
+
+#endif /* S3FIFOCACHE_H_ */
+
+/** @} */
@@ -2,6 +2,15 @@
  * Unit test for the circular buffer
  */
 
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
 #include "circularbuffer.hpp"
 #include "gtest/gtest.h"
 
@@ -190,6 +199,724 @@ TEST_F(CircularBufferTest, IsEmpty) {
     ASSERT_EQ(cbuf_.empty(), false);
 }
 
+// Element type that counts its live instances and has no default constructor.
+struct Tracked {
+    static int live;
+
+    explicit Tracked(uint32_t v) : value(v) { ++live; }
+    Tracked(const Tracked& other) : value(other.value) { ++live; }
+    Tracked& operator=(const Tracked& other) = default;
+    ~Tracked() { --live; }
+
+    uint32_t value;
+};
+
+int Tracked::live = 0;
+
+// Tests that elements are only constructed when added and destroyed when
+// removed, cleared or when the buffer is destroyed.
+TEST(CircularBufferLazyTest, ElementLifetime) {
+    Tracked::live = 0;
+    {
+        circular_buffer<Tracked> cbuf(BUF_SIZE);
+        ASSERT_EQ(Tracked::live, 0);
+
+        for (uint32_t i = 0; i < BUF_SIZE; i++) {
+            ASSERT_EQ(cbuf.push_back(Tracked(i)), true);
+        }
+        ASSERT_EQ(Tracked::live, static_cast<int>(BUF_SIZE));
+
+        Tracked data(0);
+        ASSERT_EQ(cbuf.pop_front(data), true);
+        ASSERT_EQ(data.value, 0u);
+        ASSERT_EQ(Tracked::live, static_cast<int>(BUF_SIZE));
+
+        cbuf.clear();
+        ASSERT_EQ(Tracked::live, 1);
+
+        ASSERT_EQ(cbuf.push_back(Tracked(7)), true);
+        ASSERT_EQ(Tracked::live, 2);
+    }
+    ASSERT_EQ(Tracked::live, 0);
+}
+
+// Tests that a large buffer is mapped and that prefault keeps the content.
+TEST(CircularBufferLazyTest, Prefault) {
+    const size_t num = 1u << 20;
+    circular_buffer<uint32_t> cbuf(num);
+    ASSERT_EQ(cbuf.mapped(), true);
+
+    for (uint32_t i = 0; i < 100; i++) {
+        ASSERT_EQ(cbuf.push_back(i), true);
+    }
+    cbuf.prefault();
+
+    uint32_t data;
+    for (uint32_t i = 0; i < 100; i++) {
+        ASSERT_EQ(cbuf.pop_front(data), true);
+        ASSERT_EQ(data, i);
+    }
+    ASSERT_EQ(cbuf.space(), num);
+}
+
+// Element type with a stricter alignment than the heap guarantees.
+struct alignas(64) Aligned {
+    uint32_t value;
+};
+
+// Tests that the heap storage is aligned for an over-aligned element type,
+// also after a resize.
+TEST(CircularBufferLazyTest, OverAligned) {
+    circular_buffer<Aligned> cbuf(3);
+    ASSERT_EQ(cbuf.mapped(), false);
+
+    for (uint32_t i = 0; i < 3; i++) {
+        ASSERT_EQ(cbuf.push_back(Aligned{i}), true);
+    }
+    Aligned* elem = nullptr;
+    for (size_t i = 0; i < 3; i++) {
+        ASSERT_EQ(cbuf.peek(i, elem), true);
+        ASSERT_EQ(reinterpret_cast<uintptr_t>(elem) % 64, 0u);
+        ASSERT_EQ(elem->value, i);
+    }
+
+    ASSERT_EQ(cbuf.resize(5), true);
+    ASSERT_EQ(cbuf.peek(2, elem), true);
+    ASSERT_EQ(reinterpret_cast<uintptr_t>(elem) % 64, 0u);
+    ASSERT_EQ(elem->value, 2u);
+}
+
+// Tests that a capacity whose storage size overflows is rejected.
+TEST(CircularBufferLazyTest, Oversize) {
+    ASSERT_THROW(circular_buffer<uint64_t> cbuf(SIZE_MAX / 4), std::bad_array_new_length);
+
+    circular_buffer<uint64_t> cbuf(BUF_SIZE);
+    ASSERT_EQ(cbuf.resize(SIZE_MAX / 4), false);
+    ASSERT_EQ(cbuf.space(), BUF_SIZE);
+}
+
+// Tests that Stats operation counts the operations and the high-water mark.
+TEST_F(CircularBufferTest, Stats) {
+    uint32_t data;
+
+    ASSERT_EQ(cbuf_.pop_front(data), false);
+    for (uint32_t i = 0; i < BUF_SIZE + 1; i++) {
+        cbuf_.push_back(i);
+    }
+    ASSERT_EQ(cbuf_.pop_front(data), true);
+
+    circular_buffer_stats stats = cbuf_.stats();
+    ASSERT_EQ(stats.capacity, BUF_SIZE);
+    ASSERT_EQ(stats.count, BUF_SIZE - 1);
+    ASSERT_EQ(stats.high_water, BUF_SIZE);
+    ASSERT_EQ(stats.pushes, BUF_SIZE);
+    ASSERT_EQ(stats.pops, 1u);
+    ASSERT_EQ(stats.full, 1u);
+    ASSERT_EQ(stats.empty, 1u);
+}
+
+// Tests that registered buffers are dumped and removed when destroyed.
+TEST(CircularBufferRegistryTest, Dump) {
+    auto& registry = circular_buffer_registry::instance();
+    const size_t registered = registry.size();
+
+    circular_buffer<uint32_t> cbuf(BUF_SIZE);
+    cbuf.register_as("ingress");
+    cbuf.push_back(1);
+    {
+        circular_buffer<uint32_t> other(BUF_SIZE);
+        other.register_as("egress \"1\"");
+        ASSERT_EQ(registry.size(), registered + 2);
+
+        std::ostringstream json;
+        registry.dump(json, circular_buffer_registry::json);
+        ASSERT_NE(json.str().find("\"name\": \"ingress\", \"capacity\": 4, \"count\": 1"),
+                  std::string::npos);
+        ASSERT_NE(json.str().find("egress \\\"1\\\""), std::string::npos);
+    }
+    ASSERT_EQ(registry.size(), registered + 1);
+
+    std::ostringstream text;
+    registry.dump(text);
+    ASSERT_NE(text.str().find("ingress: capacity=4 count=1 high_water=1 pushes=1"),
+              std::string::npos);
+
+    cbuf.unregister();
+    ASSERT_EQ(registry.size(), registered);
+}
+
+// A buffer with static storage duration, destroyed at exit after the tests.
+circular_buffer<uint32_t> static_cbuf(BUF_SIZE);
+
+// Tests that a static buffer stays registered until it is destroyed at exit.
+TEST(CircularBufferRegistryTest, StaticBuffer) {
+    auto& registry = circular_buffer_registry::instance();
+    const size_t registered = registry.size();
+
+    static_cbuf.register_as("static");
+    ASSERT_EQ(registry.size(), registered + 1);
+
+    std::ostringstream text;
+    registry.dump(text);
+    ASSERT_NE(text.str().find("static: capacity=4"), std::string::npos);
+}
+
+// Tests that the occupancy histogram is sampled on push and used for the
+// capacity recommendation.
+TEST(CircularBufferHistogramTest, RecommendCapacity) {
+    circular_buffer<uint32_t> cbuf(100);
+    cbuf.enable_histogram(10);
+
+    // 90 pushes at occupancy 0, 9 pushes at occupancy 0..8 and 1 at 9.
+    uint32_t data;
+    for (uint32_t i = 0; i < 90; i++) {
+        cbuf.push_back(i);
+        cbuf.pop_front(data);
+    }
+    for (uint32_t i = 0; i < 10; i++) {
+        cbuf.push_back(i);
+    }
+
+    circular_buffer_stats stats = cbuf.stats();
+    ASSERT_EQ(stats.bucket_width, 10u);
+    ASSERT_EQ(stats.histogram.size(), 11u);
+    ASSERT_EQ(stats.histogram[0], 100u);
+    ASSERT_EQ(stats.high_water, 10u);
+
+    // All samples found less than 10 elements.
+    ASSERT_EQ(stats.recommend_capacity(0.0), 10u);
+    ASSERT_EQ(stats.recommend_capacity(0.5), 10u);
+
+    // Fill the buffer, 90 more pushes of which 1 is rejected.
+    for (uint32_t i = 0; i < 91; i++) {
+        cbuf.push_back(i);
+    }
+    stats = cbuf.stats();
+    ASSERT_EQ(stats.histogram.back(), 1u);
+    ASSERT_EQ(stats.recommend_capacity(0.001), 200u);
+    ASSERT_EQ(stats.recommend_capacity(0.25), 60u);
+
+    // Reset restarts the histogram and the high-water mark.
+    for (uint32_t i = 0; i < 50; i++) {
+        cbuf.pop_front(data);
+    }
+    cbuf.reset_stats();
+    stats = cbuf.stats();
+    ASSERT_EQ(stats.high_water, 50u);
+    ASSERT_EQ(stats.recommend_capacity(0.1), 100u);
+}
+
+// Tests that Resize operation keeps the elements in order.
+TEST_F(CircularBufferTest, Resize) {
+    uint32_t data;
+
+    // Wrap the write position before resizing.
+    for (uint32_t i = 0; i < BUF_SIZE; i++) {
+        ASSERT_EQ(cbuf_.push_back(i), true);
+    }
+    ASSERT_EQ(cbuf_.pop_front(data), true);
+    ASSERT_EQ(cbuf_.push_back(BUF_SIZE), true);
+
+    ASSERT_EQ(cbuf_.resize(BUF_SIZE - 1), false);
+    ASSERT_EQ(cbuf_.resize(2 * BUF_SIZE), true);
+    ASSERT_EQ(cbuf_.space(), BUF_SIZE);
+    ASSERT_EQ(cbuf_.push_back(BUF_SIZE + 1), true);
+
+    for (uint32_t i = 1; i < BUF_SIZE + 2; i++) {
+        ASSERT_EQ(cbuf_.pop_front(data), true);
+        ASSERT_EQ(data, i);
+    }
+    ASSERT_EQ(cbuf_.empty(), true);
+}
+
+// Tests that the adaptive capacity grows on repeated full hits and shrinks
+// after sustained low occupancy, within the bounds.
+TEST(CircularBufferAutotuneTest, GrowAndShrink) {
+    circular_buffer<uint32_t> cbuf(BUF_SIZE);
+    circular_buffer_autotune policy;
+    policy.min_capacity = 2;
+    policy.max_capacity = 4 * BUF_SIZE;
+    policy.grow_after_full = 2;
+    policy.window = 8;
+    policy.shrink_after_windows = 2;
+    cbuf.enable_autotune(policy);
+
+    // The first full hit is rejected, the second one grows the buffer.
+    for (uint32_t i = 0; i < BUF_SIZE; i++) {
+        ASSERT_EQ(cbuf.push_back(i), true);
+    }
+    ASSERT_EQ(cbuf.push_back(BUF_SIZE), false);
+    ASSERT_EQ(cbuf.push_back(BUF_SIZE), true);
+    ASSERT_EQ(cbuf.stats().capacity, 2 * BUF_SIZE);
+
+    // Never beyond the upper bound.
+    for (uint32_t i = 0; i < 8 * BUF_SIZE; i++) {
+        cbuf.push_back(i);
+    }
+    ASSERT_EQ(cbuf.stats().capacity, 4 * BUF_SIZE);
+    ASSERT_EQ(cbuf.count(), 4 * BUF_SIZE);
+
+    // Occupancy 1, halve the capacity every second window until 1 is no longer
+    // below a quarter of the capacity.
+    uint32_t data;
+    cbuf.clear();
+    for (uint32_t i = 0; i < 10 * policy.window; i++) {
+        ASSERT_EQ(cbuf.push_back(i), true);
+        ASSERT_EQ(cbuf.pop_front(data), true);
+        ASSERT_EQ(data, i);
+    }
+    ASSERT_EQ(cbuf.stats().capacity, BUF_SIZE);
+
+    // Never below the lower bound.
+    policy.shrink_below = 1.0;
+    cbuf.enable_autotune(policy);
+    for (uint32_t i = 0; i < 10 * policy.window; i++) {
+        ASSERT_EQ(cbuf.push_back(i), true);
+        ASSERT_EQ(cbuf.pop_front(data), true);
+    }
+    ASSERT_EQ(cbuf.stats().capacity, 2u);
+}
+
+#ifdef __linux__
+size_t page_size() { return static_cast<size_t>(sysconf(_SC_PAGESIZE)); }
+
+// Counts the resident pages of the "bytes" long storage starting at "base".
+size_t resident_pages(const void* base, size_t bytes) {
+    const size_t page = page_size();
+    std::vector<unsigned char> vec((bytes + page - 1) / page);
+    if (mincore(const_cast<void*>(base), bytes, vec.data()) != 0) {
+        return 0;
+    }
+
+    size_t resident = 0;
+    for (auto v : vec) {
+        resident += v & 1;
+    }
+
+    return resident;
+}
+
+// Tests that Trim operation releases the pages of a drained buffer and that
+// the buffer restarts at the beginning of the storage.
+TEST(CircularBufferTrimTest, Trim) {
+    const size_t num = 1u << 20;
+    circular_buffer<uint32_t> cbuf(num);
+    ASSERT_EQ(cbuf.mapped(), true);
+
+    uint32_t data;
+    uint32_t* base;
+    ASSERT_EQ(cbuf.push_back(0), true);
+    ASSERT_EQ(cbuf.peek(0, base), true);
+    for (uint32_t i = 1; i < num / 2; i++) {
+        ASSERT_EQ(cbuf.push_back(i), true);
+    }
+    ASSERT_GE(resident_pages(base, num * sizeof(uint32_t)),
+              num / 2 * sizeof(uint32_t) / page_size());
+
+    // Half full, the free second half is released.
+    ASSERT_EQ(cbuf.trim(), num / 2 * sizeof(uint32_t));
+    ASSERT_EQ(cbuf.count(), num / 2);
+    for (uint32_t i = 0; i < num / 2; i++) {
+        ASSERT_EQ(cbuf.pop_front(data), true);
+        ASSERT_EQ(data, i);
+    }
+
+    // Drained, everything is released.
+    ASSERT_EQ(cbuf.trim(), num * sizeof(uint32_t));
+    ASSERT_EQ(resident_pages(base, num * sizeof(uint32_t)), 0u);
+
+    uint32_t* elem;
+    ASSERT_EQ(cbuf.push_back(1), true);
+    ASSERT_EQ(cbuf.peek(0, elem), true);
+    ASSERT_EQ(elem, base);
+    ASSERT_EQ(resident_pages(base, num * sizeof(uint32_t)), 1u);
+}
+
+// Tests that a drained buffer is trimmed automatically after a spike but not
+// while the occupancy stays low.
+TEST(CircularBufferTrimTest, AutoTrim) {
+    const size_t num = 1u << 20;
+    circular_buffer<uint32_t> cbuf(num);
+    cbuf.set_auto_trim(64u * 1024);
+
+    uint32_t data;
+    uint32_t* base;
+    ASSERT_EQ(cbuf.push_back(0), true);
+    ASSERT_EQ(cbuf.peek(0, base), true);
+    ASSERT_EQ(cbuf.pop_front(data), true);
+    ASSERT_EQ(resident_pages(base, num * sizeof(uint32_t)), 0u);
+
+    // Low occupancy stays on the first page.
+    for (uint32_t i = 0; i < num; i++) {
+        ASSERT_EQ(cbuf.push_back(i), true);
+        ASSERT_EQ(cbuf.pop_front(data), true);
+    }
+    ASSERT_EQ(resident_pages(base, num * sizeof(uint32_t)), 1u);
+
+    // A spike is released when drained.
+    for (uint32_t i = 0; i < num; i++) {
+        ASSERT_EQ(cbuf.push_back(i), true);
+    }
+    ASSERT_EQ(resident_pages(base, num * sizeof(uint32_t)), num * sizeof(uint32_t) / page_size());
+    for (uint32_t i = 0; i < num; i++) {
+        ASSERT_EQ(cbuf.pop_front(data), true);
+    }
+    ASSERT_EQ(resident_pages(base, num * sizeof(uint32_t)), 0u);
+}
+#endif
+
+// Tests that a drained heap backed buffer restarts at the beginning of its
+// storage when it has written more than the automatic trim threshold.
+TEST(CircularBufferTrimTest, AutoTrimHeap) {
+    circular_buffer<uint32_t> cbuf(BUF_SIZE);
+    cbuf.set_auto_trim(1);
+    ASSERT_EQ(cbuf.mapped(), false);
+
+    uint32_t data;
+    uint32_t* base;
+    uint32_t* elem;
+    ASSERT_EQ(cbuf.push_back(0), true);
+    ASSERT_EQ(cbuf.push_back(1), true);
+    ASSERT_EQ(cbuf.peek(0, base), true);
+    ASSERT_EQ(cbuf.pop_front(data), true);
+    ASSERT_EQ(cbuf.pop_front(data), true);
+
+    ASSERT_EQ(cbuf.push_back(2), true);
+    ASSERT_EQ(cbuf.peek(0, elem), true);
+    ASSERT_EQ(elem, base);
+}
+
+// Tests that buffers draw chunks from a shared budget as they fill, return
+// them as they drain and always keep their reservation.
+TEST(CircularBufferBudgetTest, DrawAndReturn) {
+    circular_buffer_budget budget(16 * sizeof(uint32_t), 4 * sizeof(uint32_t));
+    circular_buffer<uint32_t> first(64);
+    circular_buffer<uint32_t> second(64);
+
+    ASSERT_EQ(first.attach_budget(budget, 4), true);
+    ASSERT_EQ(second.attach_budget(budget, 4), true);
+    ASSERT_EQ(budget.used(), 8 * sizeof(uint32_t));
+
+    // The first buffer takes its reservation and all of the remaining budget.
+    uint32_t i = 0;
+    while (first.push_back(i)) {
+        ++i;
+    }
+    ASSERT_EQ(i, 12u);
+    ASSERT_EQ(budget.used(), budget.limit());
+    ASSERT_EQ(first.stats().granted, 12u);
+
+    // The second buffer still has its reservation.
+    for (uint32_t j = 0; j < 4; j++) {
+        ASSERT_EQ(second.push_back(j), true);
+    }
+    ASSERT_EQ(second.push_back(4), false);
+
+    // Draining the first buffer returns its chunks, so the second can grow.
+    uint32_t data;
+    for (uint32_t j = 0; j < 12; j++) {
+        ASSERT_EQ(first.pop_front(data), true);
+        ASSERT_EQ(data, j);
+    }
+    ASSERT_EQ(first.stats().granted, 4u);
+    for (uint32_t j = 4; j < 12; j++) {
+        ASSERT_EQ(second.push_back(j), true);
+    }
+
+    second.detach_budget();
+    ASSERT_EQ(budget.used(), 4 * sizeof(uint32_t));
+    ASSERT_EQ(second.push_back(12), true);
+
+    // A reservation that does not fit is refused.
+    circular_buffer<uint32_t> third(64);
+    ASSERT_EQ(third.attach_budget(budget, 13), false);
+}
+
+// Tests that the fair share admission keeps room for the other buffers.
+TEST(CircularBufferBudgetTest, FairShare) {
+    circular_buffer_budget budget(16 * sizeof(uint32_t), sizeof(uint32_t),
+                                  circular_buffer_budget::fair_share);
+    circular_buffer<uint32_t> first(64);
+    circular_buffer<uint32_t> second(64);
+    ASSERT_EQ(first.attach_budget(budget, 0), true);
+    ASSERT_EQ(second.attach_budget(budget, 0), true);
+
+    // Beyond three quarters of the budget only the fair share of 8 elements
+    // is granted.
+    uint32_t i = 0;
+    while (first.push_back(i)) {
+        ++i;
+    }
+    ASSERT_EQ(i, 12u);
+    i = 0;
+    while (second.push_back(i)) {
+        ++i;
+    }
+    ASSERT_EQ(i, 4u);
+}
+
+// Tests that the watermark callback is called once per crossing with
+// hysteresis between the high and the low watermark.
+TEST_F(CircularBufferTest, Watermarks) {
+    std::vector<bool> crossings;
+    cbuf_.set_watermarks(3, 1, [&crossings](bool above) { crossings.push_back(above); });
+
+    uint32_t data;
+    for (uint32_t i = 0; i < BUF_SIZE; i++) {
+        ASSERT_EQ(cbuf_.push_back(i), true);
+    }
+    ASSERT_EQ(crossings.size(), 1u);
+    ASSERT_EQ(crossings[0], true);
+    ASSERT_EQ(cbuf_.above_high_watermark(), true);
+
+    // Between the watermarks, no crossing.
+    ASSERT_EQ(cbuf_.pop_front(data), true);
+    ASSERT_EQ(cbuf_.pop_front(data), true);
+    ASSERT_EQ(cbuf_.push_back(0), true);
+    ASSERT_EQ(cbuf_.pop_front(data), true);
+    ASSERT_EQ(crossings.size(), 1u);
+    ASSERT_EQ(cbuf_.above_high_watermark(), true);
+
+    ASSERT_EQ(cbuf_.pop_front(data), true);
+    ASSERT_EQ(crossings.size(), 2u);
+    ASSERT_EQ(crossings[1], false);
+    ASSERT_EQ(cbuf_.above_high_watermark(), false);
+
+    // Clear crosses the low watermark.
+    for (uint32_t i = 0; i < 2; i++) {
+        ASSERT_EQ(cbuf_.push_back(i), true);
+    }
+    ASSERT_EQ(crossings.size(), 3u);
+    cbuf_.clear();
+    ASSERT_EQ(crossings.size(), 4u);
+    ASSERT_EQ(crossings[3], false);
+}
+
+// Tests that producers only push with credits, staged in batches, and that
+// the consumer returns the credits in batches, or all of them when drained.
+TEST(CircularBufferCreditTest, Batches) {
+    circular_buffer<uint32_t> cbuf(8);
+    cbuf.enable_credits(4);
+
+    {
+        credit_producer<uint32_t> producer(cbuf, 3);
+        for (uint32_t i = 0; i < 8; i++) {
+            ASSERT_EQ(producer.push_back(i), true);
+        }
+        ASSERT_EQ(producer.push_back(8), false);
+        ASSERT_EQ(cbuf.acquire_credits(1), 0u);
+
+        // Credits come back once a batch of 4 has been popped.
+        uint32_t data;
+        for (uint32_t i = 0; i < 3; i++) {
+            ASSERT_EQ(cbuf.pop_front(data), true);
+        }
+        ASSERT_EQ(producer.push_back(8), false);
+        ASSERT_EQ(cbuf.pop_front(data), true);
+        ASSERT_EQ(producer.push_back(8), true);
+        ASSERT_EQ(producer.credits(), 2u);
+
+        // The element is staged until flushed.
+        ASSERT_EQ(producer.staged(), 1u);
+        ASSERT_EQ(cbuf.count(), 4u);
+        ASSERT_EQ(producer.flush(), true);
+        ASSERT_EQ(cbuf.count(), 5u);
+
+        // Draining returns the rest.
+        while (cbuf.pop_front(data)) {
+        }
+        ASSERT_EQ(cbuf.acquire_credits(100), 6u);
+        cbuf.release_credits(6);
+    }
+
+    // The destroyed producer gave its credits back.
+    ASSERT_EQ(cbuf.acquire_credits(100), 8u);
+    cbuf.release_credits(8);
+}
+
+// Tests that clear() returns the freed slots as credits.
+TEST(CircularBufferCreditTest, Clear) {
+    circular_buffer<uint32_t> cbuf(8);
+    cbuf.enable_credits(4);
+    credit_producer<uint32_t> producer(cbuf, 8);
+
+    for (uint32_t i = 0; i < 8; i++) {
+        ASSERT_EQ(producer.push_back(i), true);
+    }
+    uint32_t data;
+    ASSERT_EQ(cbuf.pop_front(data), true);
+    cbuf.clear();
+
+    for (uint32_t i = 0; i < 8; i++) {
+        ASSERT_EQ(producer.push_back(i), true);
+    }
+    ASSERT_EQ(producer.push_back(8), false);
+}
+
+// Tests that the selector reports the non-empty buffers and wakes a waiting
+// consumer.
+TEST(CircularBufferSelectorTest, Wait) {
+    circular_buffer_selector selector;
+    circular_buffer<uint32_t> first(BUF_SIZE);
+    circular_buffer<uint32_t> second(BUF_SIZE);
+
+    ASSERT_EQ(first.push_back(1), true);
+    ASSERT_EQ(selector.add(first), 0u);
+    ASSERT_EQ(selector.add(second), 1u);
+    ASSERT_EQ(selector.add(second), circular_buffer_selector::max_buffers);
+    ASSERT_EQ(selector.poll(), 1u);
+
+    uint32_t data;
+    ASSERT_EQ(first.pop_front(data), true);
+    ASSERT_EQ(selector.wait_for(std::chrono::milliseconds(1)), 0u);
+
+    std::thread producer([&second]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        second.push_back(2);
+    });
+    uint64_t ready = selector.wait();
+    producer.join();
+    ASSERT_EQ(ready, 2u);
+
+    ASSERT_EQ(second.pop_front(data), true);
+    ASSERT_EQ(data, 2u);
+    ASSERT_EQ(selector.poll(), 0u);
+
+    // A removed buffer no longer signals and frees its bit.
+    selector.remove(first);
+    ASSERT_EQ(first.push_back(3), true);
+    ASSERT_EQ(selector.poll(), 0u);
+    ASSERT_EQ(selector.add(first), 0u);
+    ASSERT_EQ(selector.poll(), 1u);
+    first.clear();
+    ASSERT_EQ(selector.poll(), 0u);
+}
+
+// Tests that pop_batch() waits for the batch size or the deadline.
+TEST(CircularBufferBatchTest, PopBatch) {
+    circular_buffer<uint32_t> buf(BUF_SIZE);
+    std::vector<uint32_t> out;
+
+    // Empty at the deadline.
+    ASSERT_EQ(buf.pop_batch(out, 1, BUF_SIZE, std::chrono::steady_clock::now()), 0u);
+
+    // Less than the batch size at the deadline.
+    ASSERT_EQ(buf.push_back(1), true);
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(5);
+    ASSERT_EQ(buf.pop_batch(out, 2, BUF_SIZE, deadline), 1u);
+    ASSERT_GE(std::chrono::steady_clock::now(), deadline);
+
+    // Woken by the producer when the batch size is reached, and limited to
+    // "max_n" elements.
+    std::thread producer([&buf]() {
+        for (uint32_t i = 2; i <= 4; i++) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            buf.push_back(i);
+        }
+    });
+    deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    size_t num = buf.pop_batch(out, 3, 2, deadline);
+    auto woken = std::chrono::steady_clock::now();
+    producer.join();
+    ASSERT_EQ(num, 2u);
+    ASSERT_LT(woken, deadline);
+    ASSERT_EQ(buf.pop_batch(out, 1, BUF_SIZE, deadline), 1u);
+    ASSERT_EQ(out, std::vector<uint32_t>({1, 2, 3, 4}));
+    ASSERT_EQ(buf.stats().pops, 4u);
+}
+
+// Tests that the adaptive consumer grows its batch size while the latency
+// target is met, keeps it while a backlog is drained and reports it in the
+// stats.
+TEST(CircularBufferBatchTest, AdaptiveConsumer) {
+    circular_buffer<uint32_t> buf(64);
+    circular_buffer_batching policy;
+    policy.target = std::chrono::milliseconds(5);
+    policy.max_batch = 4;
+    policy.window = 2;
+    std::vector<uint32_t> out;
+
+    {
+        adaptive_consumer<uint32_t> consumer(buf, policy);
+        ASSERT_EQ(buf.stats().batch_size, 1u);
+        for (uint32_t i = 0; i < 64; i++) {
+            ASSERT_EQ(buf.push_back(i), true);
+        }
+
+        // The backlog is drained "max_batch" elements at a time while the
+        // batch size grows from 1 to 2 to 4.
+        for (size_t i = 0; i < 6; i++) {
+            ASSERT_EQ(consumer.pop_batch(out), 4u);
+        }
+        ASSERT_EQ(consumer.batch_size(), 4u);
+        ASSERT_EQ(buf.stats().batch_size, 4u);
+
+        buf.register_as("batched");
+        std::ostringstream os;
+        circular_buffer_registry::instance().dump(os);
+        ASSERT_NE(os.str().find("batched: capacity=64 count=40 "), std::string::npos);
+        ASSERT_NE(os.str().find(" batch_size=4\n"), std::string::npos);
+
+        // Without arrivals the estimated residence time exceeds the target,
+        // but the batch size is kept until the backlog is gone.
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        for (size_t i = 0; i < 9; i++) {
+            ASSERT_EQ(consumer.pop_batch(out), 4u);
+            ASSERT_EQ(consumer.batch_size(), 4u);
+        }
+        ASSERT_EQ(consumer.pop_batch(out), 4u);
+        ASSERT_EQ(buf.empty(), true);
+        ASSERT_EQ(consumer.batch_size(), 2u);
+    }
+    ASSERT_EQ(buf.stats().batch_size, 0u);
+    ASSERT_EQ(out.size(), 64u);
+}
+
+struct Record {
+    uint64_t timestamp;
+    uint32_t value;
+};
+
+// Tests the sorted key searches across the wrap of the storage.
+TEST(CircularBufferSearchTest, Bounds) {
+    circular_buffer<Record> buf(8);
+    auto timestamp = [](const Record& r) { return r.timestamp; };
+    Record r;
+
+    ASSERT_EQ(buf.lower_bound(10u, timestamp), 0u);
+    ASSERT_EQ(buf.interpolation_search(10u, timestamp), 0u);
+
+    // Timestamps 30, 40, 50, 50, 60, 70, 80, 90 with the first five at the
+    // end of the storage.
+    const uint64_t stamps[] = {0, 10, 20, 30, 40, 50, 50, 60};
+    for (auto t : stamps) {
+        ASSERT_EQ(buf.push_back(Record{t, 0}), true);
+    }
+    for (size_t i = 0; i < 3; i++) {
+        ASSERT_EQ(buf.pop_front(r), true);
+    }
+    for (uint64_t t = 70; t <= 90; t += 10) {
+        ASSERT_EQ(buf.push_back(Record{t, 0}), true);
+    }
+
+    ASSERT_EQ(buf.lower_bound(50u, timestamp), 2u);
+    ASSERT_EQ(buf.upper_bound(50u, timestamp), 4u);
+    std::pair<size_t, size_t> range = buf.equal_range(50u, timestamp);
+    ASSERT_EQ(range.first, 2u);
+    ASSERT_EQ(range.second, 4u);
+    ASSERT_EQ(buf.lower_bound(75u, timestamp), 6u);
+    ASSERT_EQ(buf.upper_bound(80u, timestamp), 7u);
+    ASSERT_EQ(buf.lower_bound(0u, timestamp), 0u);
+    ASSERT_EQ(buf.upper_bound(90u, timestamp), 8u);
+    range = buf.equal_range(55u, timestamp);
+    ASSERT_EQ(range.first, 4u);
+    ASSERT_EQ(range.second, 4u);
+
+    for (uint64_t t = 0; t <= 100; t++) {
+        ASSERT_EQ(buf.interpolation_search(t, timestamp), buf.lower_bound(t, timestamp));
+    }
+}
+
 }  // namespace
 
 int main(int argc, char** argv) {
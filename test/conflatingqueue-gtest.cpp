@@ -0,0 +1,57 @@
+/*
+ * Unit test for the conflating queue
+ */
+
+#include "conflatingqueue.hpp"
+
+#include <string>
+
+#include "gtest/gtest.h"
+
+namespace {
+
+#define BUF_SIZE 3u
+
+// Tests that a newer update replaces the pending one in its queue position.
+TEST(ConflatingQueueTest, Conflate) {
+    conflating_queue<std::string, uint32_t> queue(BUF_SIZE);
+    std::string key;
+    uint32_t data;
+
+    ASSERT_EQ(queue.pop_front(key, data), false);
+    ASSERT_EQ(queue.push_back("a", 1), true);
+    ASSERT_EQ(queue.push_back("b", 2), true);
+    ASSERT_EQ(queue.push_back("a", 3), true);
+    ASSERT_EQ(queue.push_back("c", 4), true);
+    ASSERT_EQ(queue.count(), BUF_SIZE);
+    ASSERT_EQ(queue.conflated(), 1u);
+
+    // Full for new keys, but pending keys are still replaced.
+    ASSERT_EQ(queue.push_back("d", 5), false);
+    ASSERT_EQ(queue.push_back("b", 6), true);
+
+    ASSERT_EQ(queue.pop_front(key, data), true);
+    ASSERT_EQ(key, "a");
+    ASSERT_EQ(data, 3u);
+    ASSERT_EQ(queue.pop_front(key, data), true);
+    ASSERT_EQ(key, "b");
+    ASSERT_EQ(data, 6u);
+
+    // A popped key is queued again at the back.
+    ASSERT_EQ(queue.push_back("a", 7), true);
+    ASSERT_EQ(queue.pop_front(key, data), true);
+    ASSERT_EQ(key, "c");
+    ASSERT_EQ(data, 4u);
+    ASSERT_EQ(queue.pop_front(key, data), true);
+    ASSERT_EQ(key, "a");
+    ASSERT_EQ(data, 7u);
+    ASSERT_EQ(queue.pop_front(key, data), false);
+    ASSERT_EQ(queue.count(), 0u);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,133 @@
+/*
+ * Unit test for the jitter buffer
+ */
+
+#include "jitterbuffer.hpp"
+
+#include "gtest/gtest.h"
+
+namespace {
+
+#define BUF_SIZE 8u
+
+// Tests paced playout of out of order arrivals and the drop counters.
+TEST(JitterBufferTest, Playout) {
+    jitter_buffer_config config;
+    config.min_delay = 20;
+    jitter_buffer<uint32_t> buf(BUF_SIZE, config);
+    uint32_t data;
+
+    // Sent every 10 units, with a transit time of 5 units.
+    ASSERT_EQ(buf.pop_due(0, data), false);
+    ASSERT_EQ(buf.push(0, 0, 5, 100), true);
+    ASSERT_EQ(buf.push(2, 20, 25, 102), true);
+    ASSERT_EQ(buf.push(1, 10, 25, 101), true);
+    ASSERT_EQ(buf.push(1, 10, 26, 101), false);
+    ASSERT_EQ(buf.push(BUF_SIZE, 80, 85, 108), false);
+
+    // Due at timestamp + 5 + target delay.
+    jitter_buffer_stats stats = buf.stats();
+    ASSERT_GT(stats.jitter, 0);
+    ASSERT_EQ(stats.target_delay, 20u);
+    ASSERT_EQ(buf.pop_due(24, data), false);
+    ASSERT_EQ(buf.pop_due(25, data), true);
+    ASSERT_EQ(data, 100u);
+    ASSERT_EQ(buf.pop_due(35, data), true);
+    ASSERT_EQ(data, 101u);
+    ASSERT_EQ(buf.push(0, 0, 36, 100), false);
+    ASSERT_EQ(buf.pop_due(45, data), true);
+    ASSERT_EQ(data, 102u);
+
+    // Sequence number 3 is lost, 4 is played in its own slot.
+    ASSERT_EQ(buf.push(4, 40, 45, 104), true);
+    ASSERT_EQ(buf.pop_due(55, data), false);
+    ASSERT_EQ(buf.pop_due(65, data), true);
+    ASSERT_EQ(data, 104u);
+    ASSERT_EQ(buf.push(3, 30, 66, 103), false);
+    ASSERT_EQ(buf.pop_due(75, data), false);
+
+    stats = buf.stats();
+    ASSERT_EQ(stats.received, 4u);
+    ASSERT_EQ(stats.played, 4u);
+    ASSERT_EQ(stats.late, 2u);
+    ASSERT_EQ(stats.duplicates, 1u);
+    ASSERT_EQ(stats.overflows, 1u);
+    ASSERT_EQ(stats.lost, 1u);
+    ASSERT_EQ(stats.underruns, 2u);
+}
+
+// Tests that the target delay follows the jitter within its bounds.
+TEST(JitterBufferTest, AdaptiveDelay) {
+    jitter_buffer_config config;
+    config.max_delay = 50;
+    jitter_buffer<uint32_t> buf(BUF_SIZE, config);
+
+    for (uint32_t i = 0; i < 100; i++) {
+        uint32_t data;
+        ASSERT_EQ(buf.push(i, i * 10, i * 10 + 5, i), true);
+        buf.pop_due(i * 10 + 5, data);
+    }
+    ASSERT_EQ(buf.stats().target_delay, 0u);
+
+    for (uint32_t i = 100; i < 200; i++) {
+        uint32_t data;
+        buf.push(i, i * 10, i * 10 + 5 + (i % 2) * 8, i);
+        buf.pop_due(i * 10, data);
+    }
+    jitter_buffer_stats stats = buf.stats();
+    ASSERT_NEAR(stats.jitter, 8.0, 0.5);
+    ASSERT_EQ(stats.target_delay, 31u);
+
+    for (uint32_t i = 200; i < 300; i++) {
+        uint32_t data;
+        buf.push(i, i * 10, i * 10 + 5 + (i % 2) * 30, i);
+        buf.pop_due(i * 10, data);
+    }
+    ASSERT_EQ(buf.stats().target_delay, 50u);
+}
+
+// Tests that the playout resynchronizes after a loss burst longer than the
+// capacity.
+TEST(JitterBufferTest, LossBurst) {
+    jitter_buffer<uint32_t> buf(BUF_SIZE);
+    uint32_t data;
+
+    ASSERT_EQ(buf.push(0, 0, 5, 100), true);
+    ASSERT_EQ(buf.pop_due(5, data), true);
+    for (uint32_t seq = 20; seq < 40; seq++) {
+        ASSERT_EQ(buf.push(seq, seq * 10, seq * 10 + 5, seq), true);
+        ASSERT_EQ(buf.pop_due(seq * 10 + 5, data), true);
+        ASSERT_EQ(data, seq);
+    }
+
+    // While elements are buffered, one too far ahead is still dropped.
+    ASSERT_EQ(buf.push(41, 410, 415, 41), true);
+    ASSERT_EQ(buf.push(41 + BUF_SIZE, 490, 495, 49), false);
+
+    jitter_buffer_stats stats = buf.stats();
+    ASSERT_EQ(stats.received, 22u);
+    ASSERT_EQ(stats.played, 21u);
+    ASSERT_EQ(stats.overflows, 1u);
+    ASSERT_EQ(stats.lost, 19u);
+}
+
+// Tests that a zero capacity is raised to one sequence number.
+TEST(JitterBufferTest, ZeroCapacity) {
+    jitter_buffer<uint32_t> buf(0);
+    uint32_t data;
+
+    ASSERT_EQ(buf.push(1, 0, 5, 1), true);
+    ASSERT_EQ(buf.pop_due(5, data), true);
+    ASSERT_EQ(data, 1u);
+    ASSERT_EQ(buf.push(3, 20, 25, 3), true);
+    ASSERT_EQ(buf.pop_due(25, data), true);
+    ASSERT_EQ(data, 3u);
+    ASSERT_EQ(buf.stats().lost, 1u);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,109 @@
+/*
+ * Unit test for the k-way merger
+ */
+
+#include "kwaymerger.hpp"
+
+#include <memory>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace {
+
+#define NUM_SOURCES 3u
+#define BUF_SIZE 8u
+
+// Element with a timestamp and the index of the producer.
+struct Event {
+    uint64_t time;
+    uint32_t source;
+};
+
+struct EventTime {
+    uint64_t operator()(const Event& event) const { return event.time; }
+};
+
+// The fixture for testing the k-way merger.
+class KwayMergerTest : public ::testing::Test {
+   protected:
+    KwayMergerTest() {
+        for (uint32_t i = 0; i < NUM_SOURCES; i++) {
+            bufs_.emplace_back(new circular_buffer<Event>(BUF_SIZE));
+            sources_.push_back(bufs_.back().get());
+        }
+    }
+
+    void push(uint32_t source, uint64_t time) {
+        ASSERT_EQ(bufs_[source]->push_back(Event{time, source}), true);
+    }
+
+    std::vector<std::unique_ptr<circular_buffer<Event>>> bufs_;
+    std::vector<circular_buffer<Event>*> sources_;
+};
+
+// Tests that the elements are emitted in timestamp order when all sources
+// have data.
+TEST_F(KwayMergerTest, Order) {
+    kway_merger<Event, EventTime> merger(sources_, 10);
+
+    push(0, 1);
+    push(0, 5);
+    push(0, 9);
+    push(1, 2);
+    push(1, 3);
+    push(1, 8);
+    push(1, 10);
+    push(2, 4);
+    push(2, 6);
+    push(2, 7);
+    push(2, 11);
+
+    // Stops when source 0 is drained after 9, since it could still get an
+    // element older than 10.
+    Event event;
+    for (uint64_t time = 1; time <= 9; time++) {
+        ASSERT_EQ(merger.pop_front(event), true);
+        ASSERT_EQ(event.time, time);
+    }
+    ASSERT_EQ(merger.pop_front(event), false);
+
+    push(0, 12);
+    ASSERT_EQ(merger.pop_front(event), true);
+    ASSERT_EQ(event.time, 10u);
+    ASSERT_EQ(event.source, 1u);
+}
+
+// Tests that an idle source does not stall the merge beyond the lateness and
+// that late elements are dropped.
+TEST_F(KwayMergerTest, Watermark) {
+    kway_merger<Event, EventTime> merger(sources_, 10);
+
+    push(0, 100);
+    push(1, 105);
+
+    // Source 2 is idle, wait until the watermark passes the head.
+    Event event;
+    ASSERT_EQ(merger.pop_front(event, 105), false);
+    ASSERT_EQ(merger.pop_front(event, 110), true);
+    ASSERT_EQ(event.time, 100u);
+    ASSERT_EQ(merger.pop_front(event, 110), false);
+    ASSERT_EQ(merger.pop_front(event, 115), true);
+    ASSERT_EQ(event.time, 105u);
+
+    // An element older than the emitted ones is late.
+    push(2, 103);
+    push(2, 120);
+    push(0, 121);
+    push(1, 122);
+    ASSERT_EQ(merger.pop_front(event, 200), true);
+    ASSERT_EQ(event.time, 120u);
+    ASSERT_EQ(merger.late(), 1u);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
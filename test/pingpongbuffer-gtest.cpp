@@ -0,0 +1,91 @@
+/*
+ * Unit test for the ping-pong buffer
+ */
+
+#include "pingpongbuffer.hpp"
+
+#include <thread>
+
+#include "gtest/gtest.h"
+
+namespace {
+
+#define BUF_SIZE 4u
+
+// Tests that a swap hands the whole batch over and gives the drained half
+// back.
+TEST(PingPongBufferTest, Swap) {
+    ping_pong_buffer<uint32_t> buf(BUF_SIZE);
+
+    ASSERT_EQ(buf.try_acquire(), nullptr);
+    ASSERT_EQ(buf.try_swap(), false);
+
+    circular_buffer<uint32_t>* producer = &buf.producer_half();
+    for (uint32_t i = 0; i < BUF_SIZE; i++) {
+        ASSERT_EQ(producer->push_back(i), true);
+    }
+    ASSERT_EQ(buf.try_swap(), true);
+
+    // The consumer gets the batch, the producer an empty half.
+    circular_buffer<uint32_t>* consumer = buf.try_acquire();
+    ASSERT_EQ(consumer, producer);
+    ASSERT_EQ(consumer->count(), BUF_SIZE);
+    producer = &buf.producer_half();
+    ASSERT_NE(producer, consumer);
+    ASSERT_EQ(producer->empty(), true);
+
+    // The next swap has to wait for the release.
+    ASSERT_EQ(producer->push_back(10), true);
+    ASSERT_EQ(buf.try_swap(), false);
+
+    uint32_t data;
+    for (uint32_t i = 0; i < BUF_SIZE; i++) {
+        ASSERT_EQ(consumer->pop_front(data), true);
+        ASSERT_EQ(data, i);
+    }
+    buf.release();
+    ASSERT_EQ(buf.try_acquire(), nullptr);
+    ASSERT_EQ(buf.try_swap(), true);
+    ASSERT_EQ(buf.try_acquire()->count(), 1u);
+}
+
+// Tests the blocking handover between a producer and a consumer thread.
+TEST(PingPongBufferTest, Threads) {
+    ping_pong_buffer<uint32_t> buf(BUF_SIZE);
+    const uint32_t batches = 100;
+
+    std::thread producer([&buf, batches]() {
+        circular_buffer<uint32_t>* half = &buf.producer_half();
+        for (uint32_t b = 0; b < batches; b++) {
+            for (uint32_t i = 0; i < BUF_SIZE; i++) {
+                half->push_back(b * BUF_SIZE + i);
+            }
+            half = &buf.swap();
+        }
+    });
+
+    // Keep draining on a mismatch so the producer is never left blocked, and
+    // check after the join.
+    uint32_t expected = 0;
+    uint32_t mismatches = 0;
+    for (uint32_t b = 0; b < batches; b++) {
+        circular_buffer<uint32_t>& half = buf.acquire();
+        uint32_t data;
+        while (half.pop_front(data)) {
+            if (data != expected++) {
+                ++mismatches;
+            }
+        }
+        buf.release();
+    }
+    producer.join();
+    ASSERT_EQ(mismatches, 0u);
+    ASSERT_EQ(expected, batches * BUF_SIZE);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
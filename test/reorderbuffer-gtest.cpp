@@ -0,0 +1,47 @@
+/*
+ * Unit test for the reorder buffer
+ */
+
+#include "reorderbuffer.hpp"
+
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace {
+
+// Tests that out of order completions are released in sequence order.
+TEST(ReorderBufferTest, Drain) {
+    reorder_buffer<uint32_t> buf(3, 10);
+    std::vector<uint32_t> out;
+
+    ASSERT_EQ(buf.insert(11, 110), true);
+    ASSERT_EQ(buf.insert(13, 130), true);
+    ASSERT_EQ(buf.insert(14, 140), false);
+    ASSERT_EQ(buf.insert(11, 111), false);
+    ASSERT_EQ(buf.drain(out), 0u);
+    ASSERT_EQ(buf.count(), 2u);
+
+    ASSERT_EQ(buf.insert(10, 100), true);
+    ASSERT_EQ(buf.drain(out), 2u);
+    ASSERT_EQ(out, std::vector<uint32_t>({100, 110}));
+    ASSERT_EQ(buf.next(), 12u);
+    ASSERT_EQ(buf.insert(10, 100), false);
+
+    // The ring wraps, and a lost sequence number can be skipped.
+    ASSERT_EQ(buf.insert(14, 140), true);
+    ASSERT_EQ(buf.insert(15, 150), true);
+    ASSERT_EQ(buf.skip(), true);
+    ASSERT_EQ(buf.skip(), false);
+    ASSERT_EQ(buf.drain(out), 3u);
+    ASSERT_EQ(out, std::vector<uint32_t>({100, 110, 130, 140, 150}));
+    ASSERT_EQ(buf.count(), 0u);
+    ASSERT_EQ(buf.next(), 16u);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
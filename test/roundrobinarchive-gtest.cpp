@@ -0,0 +1,68 @@
+/*
+ * Unit test for the round-robin archive
+ */
+
+#include "roundrobinarchive.hpp"
+
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace {
+
+// Tests the consolidation of samples into the coarser tiers.
+TEST(RoundRobinArchiveTest, Consolidate) {
+    round_robin_archive archive({{1, 4}, {10, 3}, {100, 2}});
+    std::vector<round_robin_row> rows;
+    round_robin_row row;
+
+    ASSERT_EQ(archive.tiers(), 3u);
+    ASSERT_EQ(archive.current(0, row), false);
+
+    // Two samples per second, the value is the time.
+    for (uint64_t t = 0; t < 250; t++) {
+        ASSERT_EQ(archive.push_back(t, static_cast<double>(t)), true);
+        ASSERT_EQ(archive.push_back(t, static_cast<double>(t) + 0.5), true);
+    }
+    ASSERT_EQ(archive.push_back(248, 0), false);
+
+    // The finest tier keeps the 4 latest completed seconds.
+    ASSERT_EQ(archive.fetch(0, rows), 4u);
+    ASSERT_EQ(rows[0].start, 245u);
+    ASSERT_EQ(rows[3].start, 248u);
+    ASSERT_EQ(rows[3].count, 2u);
+    ASSERT_EQ(rows[3].avg, 248.25);
+    ASSERT_EQ(rows[3].min, 248);
+    ASSERT_EQ(rows[3].max, 248.5);
+    ASSERT_EQ(rows[3].last, 248.5);
+
+    // Buckets of 10 s, the one from 240 s is still being accumulated.
+    rows.clear();
+    ASSERT_EQ(archive.fetch(1, rows), 3u);
+    ASSERT_EQ(rows[2].start, 230u);
+    ASSERT_EQ(rows[2].count, 20u);
+    ASSERT_EQ(rows[2].avg, 234.75);
+    ASSERT_EQ(rows[2].min, 230);
+    ASSERT_EQ(rows[2].max, 239.5);
+    ASSERT_EQ(rows[2].last, 239.5);
+    ASSERT_EQ(archive.current(1, row), true);
+    ASSERT_EQ(row.start, 240u);
+    ASSERT_EQ(row.count, 18u);
+
+    // Buckets of 100 s, completed by the first 10 s row beyond them.
+    rows.clear();
+    ASSERT_EQ(archive.fetch(2, rows), 2u);
+    ASSERT_EQ(rows[0].start, 0u);
+    ASSERT_EQ(rows[0].count, 200u);
+    ASSERT_EQ(rows[0].avg, 49.75);
+    ASSERT_EQ(rows[1].start, 100u);
+    ASSERT_EQ(rows[1].max, 199.5);
+    ASSERT_EQ(archive.fetch(3, rows), 0u);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
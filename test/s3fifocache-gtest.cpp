@@ -0,0 +1,88 @@
+/*
+ * Unit test for the S3-FIFO cache
+ */
+
+#include "s3fifocache.hpp"
+
+#include <string>
+
+#include "gtest/gtest.h"
+
+namespace {
+
+// Tests lookups, replacing and erasing.
+TEST(S3FifoCacheTest, Basic) {
+    s3fifo_cache<std::string, uint32_t> cache(4);
+
+    ASSERT_EQ(cache.find("a"), nullptr);
+    ASSERT_EQ(cache.insert("a", 1), true);
+    ASSERT_EQ(cache.insert("b", 2), true);
+    ASSERT_EQ(cache.insert("a", 3), false);
+    ASSERT_EQ(*cache.find("a"), 3u);
+    ASSERT_EQ(cache.size(), 2u);
+
+    ASSERT_EQ(cache.erase("a"), true);
+    ASSERT_EQ(cache.erase("a"), false);
+    ASSERT_EQ(cache.find("a"), nullptr);
+    ASSERT_EQ(*cache.find("b"), 2u);
+    ASSERT_EQ(cache.size(), 1u);
+    ASSERT_EQ(cache.hits(), 2u);
+    ASSERT_EQ(cache.misses(), 2u);
+
+    // The capacity is never exceeded.
+    for (uint32_t i = 0; i < 100; i++) {
+        cache.insert(std::to_string(i), i);
+        ASSERT_LE(cache.size(), 4u);
+    }
+    ASSERT_EQ(*cache.find("99"), 99u);
+}
+
+// Tests that hit entries survive a scan and that keys inserted again while
+// ghosts are admitted to the main queue.
+TEST(S3FifoCacheTest, ScanResistance) {
+    s3fifo_cache<uint32_t, uint32_t> cache(10);
+
+    for (uint32_t i = 0; i < 5; i++) {
+        ASSERT_EQ(cache.insert(i, i), true);
+        ASSERT_NE(cache.find(i), nullptr);
+    }
+    for (uint32_t i = 100; i < 200; i++) {
+        ASSERT_EQ(cache.insert(i, i), true);
+    }
+    for (uint32_t i = 0; i < 5; i++) {
+        ASSERT_NE(cache.find(i), nullptr);
+    }
+
+    // 190 is a ghost, 300 is new. Only 190 survives another scan.
+    ASSERT_EQ(cache.find(190), nullptr);
+    ASSERT_EQ(cache.insert(190, 190), true);
+    ASSERT_EQ(cache.insert(300, 300), true);
+    for (uint32_t i = 400; i < 410; i++) {
+        ASSERT_EQ(cache.insert(i, i), true);
+    }
+    ASSERT_NE(cache.find(190), nullptr);
+    ASSERT_EQ(cache.find(300), nullptr);
+    ASSERT_EQ(cache.size(), 10u);
+}
+
+// Tests plain CLOCK eviction without a small queue.
+TEST(S3FifoCacheTest, Clock) {
+    s3fifo_cache<uint32_t, uint32_t> cache(3, 0);
+
+    cache.insert(1, 1);
+    cache.insert(2, 2);
+    cache.insert(3, 3);
+    ASSERT_NE(cache.find(1), nullptr);
+    cache.insert(4, 4);
+    ASSERT_EQ(cache.find(2), nullptr);
+    ASSERT_NE(cache.find(1), nullptr);
+    ASSERT_NE(cache.find(3), nullptr);
+    ASSERT_NE(cache.find(4), nullptr);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
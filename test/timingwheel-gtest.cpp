@@ -0,0 +1,82 @@
+/*
+ * Unit test for the timing wheel
+ */
+
+#include "timingwheel.hpp"
+
+#include <stdexcept>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace {
+
+// Tests expiry on the right tick, in batches, and cancelling.
+TEST(TimingWheelTest, Expiry) {
+    timing_wheel<uint32_t> wheel(4, 8, 2);
+    std::vector<std::vector<uint32_t>> batches;
+    auto collect = [&batches](std::vector<uint32_t>& expired) { batches.push_back(expired); };
+
+    ASSERT_NE(wheel.schedule(3, 1), 0u);
+    ASSERT_NE(wheel.schedule(3, 2), 0u);
+    timing_wheel<uint32_t>::handle timer = wheel.schedule(2, 3);
+    ASSERT_NE(wheel.schedule(0, 4), 0u);
+    ASSERT_EQ(wheel.schedule(1, 5), 0u);
+    ASSERT_EQ(wheel.size(), 4u);
+
+    ASSERT_EQ(wheel.cancel(timer), true);
+    ASSERT_EQ(wheel.cancel(timer), false);
+    ASSERT_EQ(wheel.size(), 3u);
+
+    ASSERT_EQ(wheel.advance(2, collect), 1u);
+    ASSERT_EQ(batches.size(), 1u);
+    ASSERT_EQ(batches[0], std::vector<uint32_t>({4}));
+    ASSERT_EQ(wheel.advance(1, collect), 2u);
+    ASSERT_EQ(batches.size(), 2u);
+    ASSERT_EQ(batches[1].size(), 2u);
+    ASSERT_EQ(wheel.size(), 0u);
+    ASSERT_EQ(wheel.now(), 3u);
+
+    // A released node gets a new handle.
+    timing_wheel<uint32_t>::handle again = wheel.schedule(1, 6);
+    ASSERT_NE(again, timer);
+    ASSERT_EQ(wheel.cancel(timer), false);
+    ASSERT_EQ(wheel.cancel(again), true);
+}
+
+// Tests that timers on the higher levels, and beyond the range of the wheel,
+// cascade down and expire on their tick.
+TEST(TimingWheelTest, Levels) {
+    const uint64_t delays[] = {1, 7, 8, 9, 63, 64, 65, 100, 500, 1000};
+    timing_wheel<uint64_t> wheel(16, 8, 2);
+    std::vector<uint64_t> fired;
+
+    ASSERT_EQ(wheel.advance(5, [](std::vector<uint64_t>&) {}), 0u);
+    for (auto delay : delays) {
+        ASSERT_NE(wheel.schedule(delay, wheel.now() + delay), 0u);
+    }
+    while (wheel.size() != 0) {
+        wheel.advance(1, [&wheel, &fired](std::vector<uint64_t>& expired) {
+            for (auto tick : expired) {
+                ASSERT_EQ(tick, wheel.now());
+                fired.push_back(tick);
+            }
+        });
+    }
+    ASSERT_EQ(fired.size(), sizeof(delays) / sizeof(delays[0]));
+    ASSERT_EQ(wheel.now(), 1005u);
+}
+
+// Tests that a wheel whose nodes do not fit in 32-bit indices is rejected.
+TEST(TimingWheelTest, Limits) {
+    ASSERT_THROW(timing_wheel<uint32_t>(UINT32_MAX - 8, 8, 1), std::length_error);
+    ASSERT_THROW(timing_wheel<uint32_t>(1, size_t(1) << 31, 2), std::length_error);
+    ASSERT_NO_THROW(timing_wheel<uint32_t>(1, 8, 1));
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
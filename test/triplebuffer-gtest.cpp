@@ -0,0 +1,81 @@
+/*
+ * Unit test for the triple buffer
+ */
+
+#include "triplebuffer.hpp"
+
+#include <cstdint>
+#include <thread>
+
+#include "gtest/gtest.h"
+
+namespace {
+
+// Tests that the reader gets the latest value and skips older ones.
+TEST(TripleBufferTest, Latest) {
+    triple_buffer<uint32_t> buf(7);
+    uint32_t data;
+
+    ASSERT_EQ(buf.read(data), false);
+    ASSERT_EQ(data, 7u);
+
+    buf.write(1);
+    buf.write(2);
+    buf.back() = 3;
+    buf.publish();
+    ASSERT_EQ(buf.read(data), true);
+    ASSERT_EQ(data, 3u);
+    ASSERT_EQ(buf.read(data), false);
+    ASSERT_EQ(data, 3u);
+
+    buf.write(4);
+    ASSERT_EQ(buf.update(), true);
+    ASSERT_EQ(buf.front(), 4u);
+}
+
+struct Pair {
+    uint64_t a;
+    uint64_t b;
+};
+
+// Tests that a concurrent reader never sees a torn value and that the values
+// never go backwards.
+TEST(TripleBufferTest, NoTornReads) {
+    triple_buffer<Pair> buf(Pair{0, ~uint64_t(0)});
+    const uint64_t writes = 100000;
+
+    std::thread writer([&buf, writes]() {
+        for (uint64_t i = 1; i <= writes; i++) {
+            Pair& slot = buf.back();
+            slot.a = i;
+            slot.b = ~i;
+            buf.publish();
+        }
+    });
+
+    // Check after the join, a failed assertion shall not leave the writer
+    // joinable.
+    uint64_t last = 0;
+    bool torn = false;
+    bool backwards = false;
+    while (last != writes) {
+        buf.update();
+        const Pair& value = buf.front();
+        torn = (value.b != ~value.a);
+        backwards = (value.a < last);
+        if (torn || backwards) {
+            break;
+        }
+        last = value.a;
+    }
+    writer.join();
+    ASSERT_EQ(torn, false);
+    ASSERT_EQ(backwards, false);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,311 @@
+/*
+ * MIT License (MIT)
+ *
+ * Copyright (c) 2019 Kristian Kinderlöv
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @addtogroup CIRCULARBUFFER
+ * @ingroup MISC
+ * @{
+ *
+ * @file        timingwheel.hpp
+ *
+ * @brief       Hierarchical hashed timing wheel.
+ *
+ * Each level of the wheel is a circular buffer of slots whose front is the
+ * current slot, so advancing a level is a pop_front() and a push_back() of
+ * the drained slot. A slot is the head of an intrusive doubly linked list of
+ * timers in a preallocated pool, which makes scheduling and cancelling O(1).
+ * Level "l" has slots that are "slots" to the power of "l" ticks wide, and the
+ * timers of a higher level slot are moved down a level when the slot becomes
+ * current. The wheel is not thread safe and T shall be default
+ * constructible.
+ */
+
+#ifndef TIMINGWHEEL_H_
+#define TIMINGWHEEL_H_
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "circularbuffer.hpp"
+
+template <class T>
+class timing_wheel {
+   public:
+    typedef uint64_t handle;  // Identifies a scheduled timer, 0 is never used
+
+    /**
+     * @brief The timing wheel constructor.
+     *
+     * @param[in]   capacity    Maximum number of scheduled timers.
+     * @param[in]   slots       Number of slots per level, rounded up to a
+     *                          power of two.
+     * @param[in]   levels      Number of levels, at least 1.
+     * @throws      std::length_error if the timers and the slots do not fit
+     *              in 32-bit node indices.
+     */
+    explicit timing_wheel(size_t capacity, size_t slots = 256, size_t levels = 4)
+        : capacity_(checked_capacity(capacity, slots, levels)) {
+        while ((size_t(1) << bits_) < slots) {
+            ++bits_;
+        }
+        slots = size_t(1) << bits_;
+        levels = std::max<size_t>(levels, 1);
+
+        // The timer nodes are followed by one list head node per slot.
+        nodes_.resize(capacity_ + slots * levels);
+        for (uint32_t i = 0; i < capacity_; i++) {
+            nodes_[i].next = i + 1;
+        }
+        if (capacity_ != 0) {
+            nodes_[capacity_ - 1].next = nil;
+            free_ = 0;
+        }
+
+        uint32_t head = capacity_;
+        for (size_t l = 0; l < levels; l++) {
+            levels_.emplace_back(new ring(slots));
+            for (size_t s = 0; s < slots; s++, head++) {
+                nodes_[head].next = nodes_[head].prev = head;
+                levels_[l]->push_back(head);
+            }
+        }
+        expired_.reserve(64);
+    }
+
+    timing_wheel(const timing_wheel &) = delete;
+    timing_wheel &operator=(const timing_wheel &) = delete;
+
+    /**
+     * @brief Schedules a timer. Timers beyond the range of the highest level
+     * are parked in its last slot and rescheduled when it becomes current.
+     *
+     * @param[in]   ticks   Number of ticks until expiry, at least 1.
+     * @param[in]   val     The value handed to the expiry callback.
+     * @return              Handle of the timer, 0 if the wheel is full.
+     */
+    handle schedule(uint64_t ticks, const T &val) {
+        if (free_ == nil) {
+            return 0;
+        }
+        uint32_t index = free_;
+        node &n = nodes_[index];
+        free_ = n.next;
+
+        n.value = val;
+        n.expires = now_ + std::max<uint64_t>(ticks, 1);
+        insert(index);
+        ++size_;
+
+        return (static_cast<uint64_t>(n.generation) << 32) | index;
+    }
+
+    /**
+     * @brief Cancels a scheduled timer.
+     *
+     * @param[in]   timer   Handle of the timer.
+     * @return              True if success, false if the timer has already
+     *                      expired or been cancelled.
+     */
+    bool cancel(handle timer) {
+        uint32_t index = static_cast<uint32_t>(timer);
+        if ((index >= capacity_) || (nodes_[index].generation != (timer >> 32)) ||
+            (nodes_[index].prev == nil)) {
+            return false;
+        }
+        unlink(index);
+        release(index);
+
+        return true;
+    }
+
+    /**
+     * @brief Advances the wheel. The timers that expire on a tick are handed
+     * to the callback as one batch.
+     *
+     * @param[in]   ticks       Number of ticks to advance.
+     * @param[in]   expired     Callback called as expired(std::vector<T> &)
+     *                          for each tick with expired timers.
+     * @return                  The number of expired timers.
+     */
+    template <class Callback>
+    size_t advance(uint64_t ticks, Callback &&expired) {
+        size_t total = 0;
+
+        while (ticks-- > 0) {
+            ++now_;
+            rotate(0);
+            for (size_t l = 1; l < levels_.size(); l++) {
+                if ((now_ & ((uint64_t(1) << (bits_ * l)) - 1)) != 0) {
+                    break;
+                }
+                rotate(l);
+                cascade(l);
+            }
+
+            uint32_t head = current(0);
+            expired_.clear();
+            while (nodes_[head].next != head) {
+                uint32_t index = nodes_[head].next;
+                unlink(index);
+                expired_.push_back(std::move(nodes_[index].value));
+                release(index);
+            }
+            if (!expired_.empty()) {
+                total += expired_.size();
+                expired(expired_);
+            }
+        }
+
+        return total;
+    }
+
+    /**
+     * @brief Gets the number of ticks advanced since construction.
+     */
+    uint64_t now() const { return now_; };
+
+    /**
+     * @brief Gets the number of scheduled timers.
+     */
+    size_t size() const { return size_; };
+
+   private:
+    enum : uint32_t { nil = UINT32_MAX };
+
+    typedef circular_buffer<uint32_t> ring;  // Slot list heads of a level
+
+    struct node {
+        T value = T();
+        uint64_t expires = 0;     // Tick of expiry
+        uint32_t prev = nil;      // Previous node in the slot list, nil if unused
+        uint32_t next = nil;      // Next node in the slot list or the free list
+        uint32_t generation = 1;  // Incremented when released
+    };
+
+    // Gets the capacity as a node index type. Throws if the timer nodes and
+    // the list head nodes do not all get an index below nil.
+    static uint32_t checked_capacity(size_t capacity, size_t slots, size_t levels) {
+        size_t rounded = 1;
+        while ((rounded < slots) && (rounded < nil)) {
+            rounded <<= 1;
+        }
+        levels = std::max<size_t>(levels, 1);
+        if ((rounded >= nil) || (levels >= nil / rounded) ||
+            (capacity >= nil - rounded * levels)) {
+            throw std::length_error("timing_wheel: too many timers or slots");
+        }
+
+        return static_cast<uint32_t>(capacity);
+    }
+
+    // Gets the list head of the slot "offset" slots after the current one.
+    uint32_t slot(size_t level, size_t offset) {
+        uint32_t *head = nullptr;
+        levels_[level]->peek(offset, head);
+
+        return *head;
+    }
+
+    uint32_t current(size_t level) { return slot(level, 0); }
+
+    // Links a node into the slot of its expiry tick on the lowest level that
+    // covers it.
+    void insert(uint32_t index) {
+        uint64_t expires = nodes_[index].expires;
+        size_t slots = size_t(1) << bits_;
+        size_t level = 0;
+        uint64_t offset = 0;
+
+        for (; level < levels_.size(); level++) {
+            offset = (expires >> (bits_ * level)) - (now_ >> (bits_ * level));
+            if (offset < slots) {
+                break;
+            }
+        }
+        if (level == levels_.size()) {
+            level = levels_.size() - 1;
+            offset = slots - 1;
+        }
+
+        uint32_t head = slot(level, static_cast<size_t>(offset));
+        node &n = nodes_[index];
+        n.prev = head;
+        n.next = nodes_[head].next;
+        nodes_[n.next].prev = index;
+        nodes_[head].next = index;
+    }
+
+    void unlink(uint32_t index) {
+        node &n = nodes_[index];
+        nodes_[n.prev].next = n.next;
+        nodes_[n.next].prev = n.prev;
+        n.next = n.prev = nil;
+    }
+
+    void release(uint32_t index) {
+        nodes_[index].value = T();
+        ++nodes_[index].generation;
+        nodes_[index].next = free_;
+        free_ = index;
+        --size_;
+    }
+
+    // Makes the next slot of a level current. The previous one is empty.
+    void rotate(size_t level) {
+        uint32_t head;
+        levels_[level]->pop_front(head);
+        levels_[level]->push_back(head);
+    }
+
+    // Moves the timers of the current slot of a level down to lower levels.
+    void cascade(size_t level) {
+        uint32_t head = current(level);
+        uint32_t index = nodes_[head].next;
+        nodes_[head].next = nodes_[head].prev = head;
+
+        while (index != head) {
+            uint32_t next = nodes_[index].next;
+            insert(index);
+            index = next;
+        }
+    }
+
+    const uint32_t capacity_;                    // Number of timer nodes
+    size_t bits_ = 0;                            // log2 of the number of slots per level
+    std::vector<node> nodes_;                    // Timer nodes and slot list heads
+    std::vector<std::unique_ptr<ring>> levels_;  // Slot list heads per level
+    uint32_t free_ = nil;                        // First unused timer node
+    uint64_t now_ = 0;                           // Current tick
+    size_t size_ = 0;                            // Number of scheduled timers
+    std::vector<T> expired_;                     // Batch handed to the callback
+};
+
+#endif /* TIMINGWHEEL_H_ */
+
+/** @} */
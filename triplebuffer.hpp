@@ -0,0 +1,138 @@
+/*
+ * MIT License (MIT)
+ *
+ * Copyright (c) 2019 Kristian Kinderlöv
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @addtogroup CIRCULARBUFFER
+ * @ingroup MISC
+ * @{
+ *
+ * @file        triplebuffer.hpp
+ *
+ * @brief       Wait-free triple buffer for publishing the latest value.
+ *
+ * The writer owns one slot, the reader owns another one and the third slot
+ * holds the latest published value. Publishing and fetching exchange the own
+ * slot with the middle one through a single atomic, so neither side ever
+ * blocks, intermediate values are overwritten instead of queued and the
+ * reader never sees a slot that the writer is modifying.
+ */
+
+#ifndef TRIPLEBUFFER_H_
+#define TRIPLEBUFFER_H_
+
+#include <atomic>
+
+template <class T>
+class triple_buffer {
+   public:
+    /**
+     * @brief The triple buffer constructor.
+     *
+     * @param[in]   init    The value that the reader sees before the first
+     *                      publication.
+     */
+    explicit triple_buffer(const T &init = T()) : slots_{init, init, init} {
+        // Do nothing.
+    }
+
+    triple_buffer(const triple_buffer &) = delete;
+    triple_buffer &operator=(const triple_buffer &) = delete;
+
+    /**
+     * @brief Gets the writer slot, to be filled in place before publish().
+     * Shall only be used by the writer thread.
+     *
+     * @return              The writer slot.
+     */
+    T &back() { return slots_[back_]; }
+
+    /**
+     * @brief Publishes the writer slot as the latest value. Wait-free.
+     */
+    void publish() {
+        unsigned old = middle_.exchange(back_ | fresh, std::memory_order_acq_rel);
+        back_ = old & index_mask;
+    }
+
+    /**
+     * @brief Publishes a value as the latest value. Wait-free.
+     *
+     * @param[in]   value   The value to publish.
+     */
+    void write(const T &value) {
+        back() = value;
+        publish();
+    }
+
+    /**
+     * @brief Fetches the latest published value into the reader slot, if
+     * there is a newer one. Wait-free. Shall only be used by the reader
+     * thread.
+     *
+     * @return              True if a new value was fetched, false if the
+     *                      reader slot already holds the latest value.
+     */
+    bool update() {
+        if ((middle_.load(std::memory_order_relaxed) & fresh) == 0) {
+            return false;
+        }
+        unsigned old = middle_.exchange(front_, std::memory_order_acq_rel);
+        front_ = old & index_mask;
+
+        return true;
+    }
+
+    /**
+     * @brief Gets the reader slot, which is valid until the next update().
+     * Shall only be used by the reader thread.
+     *
+     * @return              The reader slot.
+     */
+    const T &front() const { return slots_[front_]; }
+
+    /**
+     * @brief Reads the latest published value. Wait-free.
+     *
+     * @param[out]  value   The latest value.
+     * @return              True if the value is new since the last read.
+     */
+    bool read(T &value) {
+        bool updated = update();
+        value = front();
+
+        return updated;
+    }
+
+   private:
+    enum : unsigned { index_mask = 3, fresh = 4 };
+
+    T slots_[3];                       // The writer, middle and reader slots
+    unsigned back_ = 0;                // Writer slot index
+    std::atomic<unsigned> middle_{1};  // Middle slot index and fresh flag
+    unsigned front_ = 2;               // Reader slot index
+};
+
+#endif /* TRIPLEBUFFER_H_ */
+
+/** @} */